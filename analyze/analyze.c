@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/defs.h"
+#include "chip8.h"
+#include "chip8_analyze.h"
+
+#define RET_ERROR(...) \
+	do { \
+		fprintf(stderr, __VA_ARGS__); \
+		putc('\n', stderr); \
+		return __LINE__; \
+	} while (0)
+
+#define CODE_BYTE (CHIP8_BYTE_CODE | CHIP8_BYTE_CODE_TAIL)
+
+static const char *edge_name(enum chip8_edge_kind k)
+{
+	switch (k) {
+	case CHIP8_EDGE_NEXT:
+		return "next";
+	case CHIP8_EDGE_SKIP:
+		return "skip";
+	case CHIP8_EDGE_JUMP:
+		return "jump";
+	case CHIP8_EDGE_CALL:
+		return "call";
+	}
+	return "?";
+}
+
+// Describes a byte that is not code.
+static const char *data_kind(u8 flags)
+{
+	if (flags & CHIP8_BYTE_WRITTEN)
+		return "written";
+	if (flags & CHIP8_BYTE_SPRITE)
+		return "sprite";
+	if (flags & CHIP8_BYTE_READ)
+		return "read";
+	return "unreached";
+}
+
+static void print_insn(const struct chip8_analysis *a, uint pc)
+{
+	char text[32];
+	const u16 ins = a->mem[pc] << 8 | a->mem[pc + 1];
+	chip8_format_insn(text, sizeof text, chip8_decode(ins));
+	printf("    %03X: %04X  %s\n", pc, ins, text);
+}
+
+static void print_listing(const struct chip8_analysis *a, uint start, uint end)
+{
+	const u8 *flags = a->flags;
+	uint pc = start;
+	while (pc < end) {
+		if (flags[pc] & CHIP8_BYTE_CODE) {
+			if (flags[pc] & CHIP8_BYTE_CALL_TARGET)
+				printf("sub_%03X:\n", pc);
+			else if (flags[pc] & CHIP8_BYTE_JUMP_TARGET)
+				printf("loc_%03X:\n", pc);
+			print_insn(a, pc);
+			pc += 2;
+			continue;
+		}
+		if (flags[pc] & CHIP8_BYTE_CODE_TAIL) {
+			pc++;
+			continue;
+		}
+
+		// Up to 8 data bytes of the same kind per line.
+		const char *kind = data_kind(flags[pc]);
+		printf("    %03X:", pc);
+		for (uint n = 0; n < 8 && pc < end && !(flags[pc] & CODE_BYTE) &&
+			 data_kind(flags[pc]) == kind;
+			 n++, pc++)
+			printf(" %02X", a->mem[pc]);
+		printf("  ; %s\n", kind);
+	}
+}
+
+static void print_dot(const struct chip8_analysis *a)
+{
+	printf("digraph rom {\n\tnode [shape=box fontname=monospace];\n");
+	for (size_t b = 0; b < a->nblocks; b++) {
+		const struct chip8_block *blk = &a->blocks[b];
+		char text[32];
+		printf("\tb%03X [label=\"", blk->start);
+		for (uint pc = blk->start; pc < blk->end; pc += 2) {
+			chip8_format_insn(
+				text,
+				sizeof text,
+				chip8_decode(a->mem[pc] << 8 | a->mem[pc + 1]));
+			printf("%03X: %s\\l", pc, text);
+		}
+		printf("\"%s];\n", blk->exits ? " peripheries=2" : "");
+	}
+	for (size_t e = 0; e < a->nedges; e++) {
+		const struct chip8_edge *edge = &a->edges[e];
+		printf(
+			"\tb%03X -> b%03X [label=%s%s];\n",
+			edge->from,
+			edge->to,
+			edge_name(edge->kind),
+			edge->kind == CHIP8_EDGE_CALL ? " style=dashed" : "");
+	}
+	printf("}\n");
+}
+
+static void print_report(
+	const struct chip8_analysis *a,
+	const char *path,
+	size_t rom_size)
+{
+	printf("%s: %zu bytes\n", path, rom_size);
+	if (a->static_code)
+		printf("static code: safe for optimized execution\n");
+	else
+		printf("dynamic code: keep on the interpreter\n");
+
+	for (size_t j = 0; j < a->ndynamic_jumps; j++)
+		printf("  %03X: jump target depends on V0\n", a->dynamic_jumps[j]);
+
+	for (size_t s = 0; s < a->nstores; s++) {
+		const struct chip8_store *st = &a->stores[s];
+		if (!st->hits_code)
+			continue;
+		if (!st->ni) {
+			printf("  %03X: writes through an unknown I\n", st->pc);
+			continue;
+		}
+		// Only the values of I that reach code.
+		for (uint k = 0; k < st->ni; k++) {
+			const uint from = st->i[k], to = from + st->len - 1;
+			bool code = false;
+			for (uint b = from; b <= to && b < 0x1000; b++)
+				code |= (a->flags[b] & CODE_BYTE) != 0;
+			if (!code)
+				continue;
+			if (from == to)
+				printf("  %03X: writes %03X, which holds code\n", st->pc, from);
+			else
+				printf(
+					"  %03X: writes %03X-%03X, which holds code\n",
+					st->pc,
+					from,
+					to);
+		}
+	}
+
+	for (size_t i = 0; i < a->ninvalid; i++)
+		printf("  %03X: reachable invalid instruction\n", a->invalid[i]);
+
+	printf("\n%zu blocks, %zu edges\n", a->nblocks, a->nedges);
+	for (size_t b = 0; b < a->nblocks; b++) {
+		const struct chip8_block *blk = &a->blocks[b];
+		printf("  %03X-%03X", blk->start, blk->end - 1);
+		for (size_t e = 0; e < a->nedges; e++)
+			if (a->edges[e].from == blk->start)
+				printf(
+					" %s:%03X",
+					edge_name(a->edges[e].kind),
+					a->edges[e].to);
+		printf("%s\n", blk->exits ? " exit" : "");
+	}
+
+	printf("\n");
+	// Code outside the ROM, such as jumps into zeroed memory, is listed too.
+	uint end = 0x200 + rom_size;
+	for (uint pc = end; pc < 0x1000; pc++)
+		if (a->flags[pc] & CODE_BYTE)
+			end = pc + 1;
+	print_listing(a, 0x200, end);
+}
+
+static void usage(void)
+{
+	fputs(
+		"Usage: chip8-analyze [options] ROM\n"
+		"Lists code, data and control flow of a ROM without running it.\n"
+		"  --dot    Print the control flow graph for Graphviz instead\n",
+		stderr);
+}
+
+int analyze_main(int argc, char *argv[])
+{
+	const char *rompath = NULL;
+	bool dot = false;
+
+	for (int a = 1; a < argc; a++) {
+		if (!strcmp(argv[a], "--help")) {
+			usage();
+			return 0;
+		} else if (!strcmp(argv[a], "--dot")) {
+			dot = true;
+		} else if (argv[a][0] == '-' || rompath) {
+			usage();
+			RET_ERROR("Unexpected argument: %s", argv[a]);
+		} else {
+			rompath = argv[a];
+		}
+	}
+
+	if (!rompath) {
+		usage();
+		RET_ERROR("Must specify a ROM to read.");
+	}
+
+	static u8 rom_buffer[CHIP8_MAX_ROM_SIZE];
+	FILE *rom = fopen(rompath, "rb");
+	if (!rom)
+		RET_ERROR("Failed to open ROM file: %s", rompath);
+	const size_t rom_size = fread(rom_buffer, 1, sizeof rom_buffer, rom);
+	if (ferror(rom))
+		RET_ERROR("Error reading ROM file.");
+	fclose(rom);
+
+	static struct chip8_analysis analysis;
+	if (!chip8_analyze(rom_buffer, rom_size, &analysis))
+		RET_ERROR("Out of memory.");
+
+	if (dot)
+		print_dot(&analysis);
+	else
+		print_report(&analysis, rompath, rom_size);
+
+	chip8_analysis_free(&analysis);
+	return 0;
+}
@@ -0,0 +1,3 @@
+int analyze_main(int, char *[]);
+
+int main(int argc, char *argv[]) { return analyze_main(argc, argv); }
@@ -0,0 +1,506 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/defs.h"
+#include "../src/workers.h"
+#include "chip8.h"
+#include "set.h"
+
+#define RET_ERROR(...) \
+	do { \
+		fprintf(stderr, __VA_ARGS__); \
+		putc('\n', stderr); \
+		return __LINE__; \
+	} while (0)
+
+// Only the first input sequence found for each crash is kept.
+#define MAX_CRASHES 256
+
+// What a paused state is waiting for before it can go on.
+enum decision {
+	// A new frame begins. The input picks the keys held during it.
+	DECIDE_FRAME,
+	// LD VX, K. The input is the key pressed.
+	DECIDE_KEY,
+	// RND VX, NN. The input is the random byte.
+	DECIDE_RAND,
+};
+
+// The emulator paused where the next input has to be chosen.
+struct state {
+	struct chip8 emu;
+	// The delay timer counts down once per frame.
+	u8 dtimer;
+	// Instructions left in the current frame.
+	u16 frame_left;
+	enum decision decision;
+	// Index of the node that reached this state.
+	u32 node;
+};
+
+// One input, as a link in the tree of input sequences.
+struct node {
+	u32 parent;
+	u8 decision;
+	// The key pressed, the random byte, or for a frame 0 for no key and
+	// k + 1 for key k held.
+	u8 value;
+};
+
+struct crash {
+	enum chip8_interrupt in;
+	u16 pc;
+	// The node of the input that led to the crash.
+	u32 node;
+};
+
+static struct {
+	uint cycles_per_frame;
+	uint rand_choices;
+
+	struct hash_set seen;
+
+	struct node *nodes;
+	atomic_uint nnodes;
+	uint max_nodes;
+
+	struct state *frontier;
+	size_t frontier_len;
+	struct state *next;
+	atomic_size_t next_len;
+	size_t next_cap;
+
+	// One bit per address an instruction was executed from.
+	atomic_uint_least64_t coverage[0x1000 / 64];
+
+	pthread_mutex_t crash_lock;
+	struct crash crashes[MAX_CRASHES];
+	uint ncrashes;
+} ex;
+
+static u64 hash_bytes(u64 h, const void *data, size_t len)
+{
+	const u8 *p = data;
+	for (; len >= 8; p += 8, len -= 8) {
+		u64 w;
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 29;
+	}
+	for (; len; p++, len--)
+		h = (h ^ *p) * 0x100000001B3ULL;
+	return h;
+}
+
+// Hashes everything that decides the future of a state.
+// Fields are hashed one at a time so struct padding is left out.
+static u64 hash_state(const struct state *s)
+{
+	const struct chip8 *e = &s->emu;
+	const u16 regs[] = {
+		e->gfx_wrapping,
+		e->i,
+		e->pc,
+		e->sp,
+		// The next frame replaces the keys before they are read.
+		s->decision == DECIDE_FRAME ? 0 : e->keys,
+		s->dtimer,
+		s->frame_left,
+		s->decision,
+	};
+	u64 h = 0xCBF29CE484222325ULL;
+	h = hash_bytes(h, regs, sizeof regs);
+	h = hash_bytes(h, e->v, sizeof e->v);
+	// Slots at and above sp are written by CALL before RET reads them.
+	h = hash_bytes(h, e->sas, e->sp * sizeof e->sas[0]);
+	h = hash_bytes(h, e->mem, sizeof e->mem);
+	h = hash_bytes(h, e->fb, sizeof e->fb);
+	return h;
+}
+
+static void cover(u16 pc)
+{
+	atomic_uint_least64_t *word = &ex.coverage[pc / 64];
+	const u64 bit = (u64)1 << pc % 64;
+	if (!(atomic_load_explicit(word, memory_order_relaxed) & bit))
+		atomic_fetch_or_explicit(word, bit, memory_order_relaxed);
+}
+
+// Runs until the next decision. Returns CHIP8_OK, or the interrupt the
+// emulator crashed on.
+static enum chip8_interrupt advance(struct state *s)
+{
+	while (1) {
+		if (s->frame_left == 0) {
+			s->decision = DECIDE_FRAME;
+			return CHIP8_OK;
+		}
+		s->frame_left--;
+
+		const u16 pc = s->emu.pc;
+		if (pc < 0x1000)
+			cover(pc);
+
+		const enum chip8_interrupt in = chip8_cycle(&s->emu);
+		switch (in) {
+		case CHIP8_OK:
+		case CHIP8_GFX_CLEAR:
+		case CHIP8_GFX_DRAW:
+		case CHIP8_SOUND_TIMER_WRITE:
+			break;
+		case CHIP8_DELAY_TIMER_WRITE:
+			s->dtimer = s->emu.dtimer_buf;
+			break;
+		case CHIP8_NEED_DELAY_TIMER:
+			chip8_supply_delay_timer(&s->emu, s->dtimer);
+			break;
+		case CHIP8_NEED_KEY:
+			s->decision = DECIDE_KEY;
+			return CHIP8_OK;
+		case CHIP8_NEED_RAND:
+			s->decision = DECIDE_RAND;
+			return CHIP8_OK;
+		default:
+			return in;
+		}
+	}
+}
+
+static uint choice_count(enum decision d)
+{
+	switch (d) {
+	case DECIDE_FRAME:
+		return 17;
+	case DECIDE_KEY:
+		return 16;
+	case DECIDE_RAND:
+		return ex.rand_choices;
+	}
+	return 0;
+}
+
+// Returns the input value of the c'th choice of a decision.
+static u8 choice_value(enum decision d, uint c)
+{
+	if (d == DECIDE_RAND)
+		// Spread evenly over [0, 255].
+		return ex.rand_choices == 1 ? 0 : c * 255 / (ex.rand_choices - 1);
+	return c;
+}
+
+static void apply(struct state *s, u8 value)
+{
+	switch (s->decision) {
+	case DECIDE_FRAME:
+		s->emu.keys = value ? 1 << (value - 1) : 0;
+		if (s->dtimer)
+			s->dtimer--;
+		s->frame_left = ex.cycles_per_frame;
+		break;
+	case DECIDE_KEY:
+		chip8_supply_key(&s->emu, value);
+		break;
+	case DECIDE_RAND:
+		chip8_supply_rand(&s->emu, value);
+		break;
+	}
+}
+
+// Takes a node for a new input. Returns false when the budget is spent.
+static bool new_node(u32 parent, enum decision d, u8 value, u32 *id)
+{
+	const uint n = atomic_fetch_add(&ex.nnodes, 1);
+	if (n >= ex.max_nodes)
+		return false;
+	ex.nodes[n] = (struct node){parent, d, value};
+	*id = n;
+	return true;
+}
+
+// Records a crash unless one like it is already known. 'input' is the input
+// that led to it, NULL for a crash before any input. A node is only taken for
+// new crashes.
+static void record_crash(
+	enum chip8_interrupt in, u16 pc, const struct node *input)
+{
+	pthread_mutex_lock(&ex.crash_lock);
+	bool known = false;
+	for (uint c = 0; c < ex.ncrashes; c++)
+		known |= ex.crashes[c].in == in && ex.crashes[c].pc == pc;
+	u32 id = 0;
+	if (!known && ex.ncrashes < MAX_CRASHES &&
+		(!input || new_node(input->parent, input->decision, input->value, &id)))
+		ex.crashes[ex.ncrashes++] = (struct crash){in, pc, id};
+	pthread_mutex_unlock(&ex.crash_lock);
+}
+
+// The number of nodes taken. Failed attempts past the budget still count in
+// nnodes, so it is clamped.
+static uint used_nodes(void)
+{
+	const uint n = atomic_load(&ex.nnodes);
+	return n < ex.max_nodes ? n : ex.max_nodes;
+}
+
+// Tries every input on the i'th state of the frontier.
+static void expand(void *ctx, size_t i)
+{
+	(void)ctx;
+	const struct state *from = &ex.frontier[i];
+	struct state s;
+
+	for (uint c = 0; c < choice_count(from->decision); c++) {
+		const u8 value = choice_value(from->decision, c);
+		s = *from;
+		apply(&s, value);
+		const enum chip8_interrupt in = advance(&s);
+
+		if (in != CHIP8_OK) {
+			const struct node input = {from->node, from->decision, value};
+			record_crash(in, s.emu.pc, &input);
+			continue;
+		}
+
+		if (!hash_set_insert(&ex.seen, hash_state(&s)))
+			continue;
+		if (!new_node(from->node, from->decision, value, &s.node))
+			return;
+
+		const size_t slot = atomic_fetch_add(&ex.next_len, 1);
+		if (slot < ex.next_cap)
+			ex.next[slot] = s;
+	}
+}
+
+static void print_inputs(u32 node)
+{
+	// Walk back to the root, then print in order.
+	uint depth = 0;
+	for (u32 n = node; n; n = ex.nodes[n].parent)
+		depth++;
+
+	u32 *path = malloc((depth + 1) * sizeof *path);
+	if (!path)
+		return;
+	uint d = depth;
+	for (u32 n = node; n; n = ex.nodes[n].parent)
+		path[--d] = n;
+
+	printf("  inputs:");
+	for (d = 0; d < depth; d++) {
+		const struct node *n = &ex.nodes[path[d]];
+		switch (n->decision) {
+		case DECIDE_FRAME:
+			if (n->value)
+				printf(" frame:%X", n->value - 1);
+			else
+				printf(" frame:-");
+			break;
+		case DECIDE_KEY:
+			printf(" key:%X", n->value);
+			break;
+		case DECIDE_RAND:
+			printf(" rand:%02X", n->value);
+			break;
+		}
+	}
+	putchar('\n');
+	free(path);
+}
+
+static bool covered(uint pc)
+{
+	return pc < 0x1000 && ex.coverage[pc / 64] & (u64)1 << pc % 64;
+}
+
+static void print_coverage(void)
+{
+	uint count = 0;
+	printf("coverage:");
+	for (uint pc = 0; pc < 0x1000; pc++) {
+		if (!covered(pc))
+			continue;
+		count++;
+		// Print each run of consecutive instructions once, as a range.
+		if (pc >= 2 && covered(pc - 2))
+			continue;
+		uint end = pc;
+		while (covered(end + 2))
+			end += 2;
+		if (end == pc)
+			printf(" %03X", pc);
+		else
+			printf(" %03X-%03X", pc, end);
+	}
+	printf("\ncovered instructions: %u\n", count);
+}
+
+static void usage(void)
+{
+	fputs(
+		"Usage: chip8-explore [options] ROM\n"
+		"Breadth first search of the states a ROM can reach.\n"
+		"  --threads N      Worker threads, 0 for one per CPU (default 0)\n"
+		"  --max-states N   Stop after N distinct states (default 50000)\n"
+		"  --max-depth N    Stop after N inputs deep (default unlimited)\n"
+		"  --cycles N       Instructions per 60 Hz frame (default 10)\n"
+		"  --rand N         Random bytes tried for each RND (default 4)\n"
+		"Each state takes about 6 KB, twice over while it is in the "
+		"frontier.\n",
+		stderr);
+}
+
+int explore_main(int argc, char *argv[])
+{
+	const char *rompath = NULL;
+	uint threads = 0;
+	ulong max_states = 50000;
+	ulong max_depth = 0;
+	ex.cycles_per_frame = 10;
+	ex.rand_choices = 4;
+
+	for (int a = 1; a < argc; a++) {
+		ulong *opt = NULL;
+		ulong val;
+		if (!strcmp(argv[a], "--help")) {
+			usage();
+			return 0;
+		}
+		if (argv[a][0] != '-') {
+			if (rompath)
+				RET_ERROR("Only one ROM expected.");
+			rompath = argv[a];
+			continue;
+		}
+		if (a + 1 == argc)
+			RET_ERROR("Option %s needs a value.", argv[a]);
+		val = strtoul(argv[a + 1], NULL, 10);
+		if (!strcmp(argv[a], "--threads"))
+			threads = val;
+		else if (!strcmp(argv[a], "--max-states"))
+			opt = &max_states;
+		else if (!strcmp(argv[a], "--max-depth"))
+			opt = &max_depth;
+		else if (!strcmp(argv[a], "--cycles"))
+			ex.cycles_per_frame = val;
+		else if (!strcmp(argv[a], "--rand"))
+			ex.rand_choices = val;
+		else {
+			usage();
+			RET_ERROR("Unknown option: %s", argv[a]);
+		}
+		if (opt)
+			*opt = val;
+		a++;
+	}
+
+	if (!rompath) {
+		usage();
+		RET_ERROR("Must specify a ROM to read.");
+	}
+	if (ex.cycles_per_frame == 0 || ex.cycles_per_frame > 0xFFFF)
+		RET_ERROR("--cycles must be in the range [1, 65535].");
+	if (ex.rand_choices == 0 || ex.rand_choices > 256)
+		RET_ERROR("--rand must be in the range [1, 256].");
+	if (max_states == 0 || max_states >= 0xFFFFFFFF)
+		RET_ERROR("--max-states is out of range.");
+
+	static u8 rom_buffer[CHIP8_MAX_ROM_SIZE];
+	FILE *rom = fopen(rompath, "rb");
+	if (!rom)
+		RET_ERROR("Failed to open ROM file: %s", rompath);
+	const size_t rom_size = fread(rom_buffer, 1, sizeof rom_buffer, rom);
+	if (ferror(rom))
+		RET_ERROR("Error reading ROM file.");
+	fclose(rom);
+
+	struct workers *workers = workers_create(threads);
+	if (!workers)
+		RET_ERROR("Failed to start worker threads.");
+
+	// Node zero is the root, before any input.
+	ex.max_nodes = max_states + 1;
+	ex.nodes = malloc(ex.max_nodes * sizeof ex.nodes[0]);
+	if (!ex.nodes || !hash_set_init(&ex.seen, max_states))
+		RET_ERROR("Out of memory.");
+	ex.nodes[0] = (struct node){0, DECIDE_FRAME, 0};
+	atomic_init(&ex.nnodes, 1);
+	pthread_mutex_init(&ex.crash_lock, NULL);
+
+	ex.frontier = malloc(sizeof ex.frontier[0]);
+	if (!ex.frontier)
+		RET_ERROR("Out of memory.");
+	struct state *root = ex.frontier;
+	memset(root, 0, sizeof *root);
+	chip8_init(&root->emu, rom_buffer, rom_size);
+	root->frame_left = ex.cycles_per_frame;
+	const enum chip8_interrupt in = advance(root);
+	if (in != CHIP8_OK)
+		record_crash(in, root->emu.pc, NULL);
+	else
+		hash_set_insert(&ex.seen, hash_state(root));
+	ex.frontier_len = in == CHIP8_OK;
+
+	ulong depth = 0;
+	while (ex.frontier_len && (!max_depth || depth < max_depth)) {
+		const uint used = atomic_load(&ex.nnodes);
+		if (used >= ex.max_nodes)
+			break;
+
+		// Every new state needs a node, so the budget bounds the frontier.
+		size_t cap = 0;
+		for (size_t i = 0; i < ex.frontier_len; i++)
+			cap += choice_count(ex.frontier[i].decision);
+		if (cap > ex.max_nodes - used)
+			cap = ex.max_nodes - used;
+
+		ex.next = malloc(cap * sizeof ex.next[0]);
+		if (!ex.next)
+			RET_ERROR("Out of memory for %zu states.", cap);
+		ex.next_cap = cap;
+		atomic_store(&ex.next_len, 0);
+
+		workers_run(workers, expand, NULL, ex.frontier_len);
+
+		free(ex.frontier);
+		ex.frontier = ex.next;
+		ex.frontier_len = atomic_load(&ex.next_len);
+		if (ex.frontier_len > cap)
+			ex.frontier_len = cap;
+		depth++;
+
+		fprintf(
+			stderr,
+			"depth %lu: %zu new states, %u total\n",
+			depth,
+			ex.frontier_len,
+			used_nodes() - 1);
+	}
+
+	const uint nodes = used_nodes();
+	printf(
+		"explored %u inputs to depth %lu%s\n",
+		nodes - 1,
+		depth,
+		ex.frontier_len ? " (stopped early)" : "");
+	print_coverage();
+
+	for (uint c = 0; c < ex.ncrashes; c++) {
+		const struct crash *cr = &ex.crashes[c];
+		printf(
+			"crash %d at %03X: %s\n",
+			cr->in,
+			cr->pc,
+			chip8_interrupt_desc(cr->in));
+		print_inputs(cr->node);
+	}
+
+	free(ex.frontier);
+	free(ex.nodes);
+	hash_set_free(&ex.seen);
+	workers_destroy(workers);
+	return 0;
+}
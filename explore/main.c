@@ -0,0 +1,3 @@
+int explore_main(int, char *[]);
+
+int main(int argc, char *argv[]) { return explore_main(argc, argv); }
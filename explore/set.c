@@ -0,0 +1,38 @@
+#include "set.h"
+
+#include <stdlib.h>
+
+// Zero marks an empty slot, so the hash zero is stored as one.
+#define EMPTY 0
+
+bool hash_set_init(struct hash_set *set, size_t n)
+{
+	// Keep the load factor at or below one half so probes stay short.
+	size_t cap = 16;
+	while (cap < n * 2)
+		cap *= 2;
+
+	set->slots = calloc(cap, sizeof set->slots[0]);
+	set->mask = cap - 1;
+	return set->slots != NULL;
+}
+
+void hash_set_free(struct hash_set *set) { free((void *)set->slots); }
+
+bool hash_set_insert(struct hash_set *set, u64 h)
+{
+	if (h == EMPTY)
+		h = 1;
+
+	for (u64 i = h;; i++) {
+		_Atomic u64 *slot = &set->slots[i & set->mask];
+		u64 cur = atomic_load_explicit(slot, memory_order_relaxed);
+		if (cur == EMPTY &&
+			atomic_compare_exchange_strong_explicit(
+				slot, &cur, h, memory_order_relaxed, memory_order_relaxed))
+			return true;
+		// Either the slot was taken or another thread just took it.
+		if (cur == h)
+			return false;
+	}
+}
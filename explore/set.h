@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include "../src/defs.h"
+
+// A lock-free set of 64 bit hashes with a fixed capacity.
+// Any number of threads may insert at once.
+struct hash_set {
+	_Atomic u64 *slots;
+	u64 mask;
+};
+
+// Makes room for at least 'n' hashes. Returns false when out of memory.
+bool hash_set_init(struct hash_set *, size_t n);
+
+void hash_set_free(struct hash_set *);
+
+// Adds a hash. Returns true if it was not in the set yet.
+// Must not be called more times than the capacity given to hash_set_init.
+bool hash_set_insert(struct hash_set *, u64 h);
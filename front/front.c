@@ -3,19 +3,40 @@
 #include <SDL2/SDL_timer.h>
 #include <SDL2/SDL_video.h>
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "../src/defs.h"
+#include "../src/runner.h"
 #include "chip8.h"
 
 static u8 rom_buffer[CHIP8_MAX_ROM_SIZE];
 
-static struct chip8 chip8;
+static struct runner runner;
+
+// The real state while a frame run ahead is being presented.
+static struct runner real;
+
+// Instructions per second when --hz is not given.
+#define DEFAULT_HZ 600
+
+// The most instructions per second --hz accepts.
+#define MAX_HZ 1000000
+
+// The most frames --run-ahead may emulate ahead of the real state.
+#define MAX_RUN_AHEAD 16
+
+// Never run more than this many frames at once to catch up with the wall
+// clock, e.g. after the window was dragged. The rest are skipped.
+#define MAX_CATCHUP_FRAMES 6
 
 #define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
 
@@ -25,11 +46,16 @@ static struct chip8 chip8;
 		return __LINE__; \
 	} while (0)
 
+static const char usage[] =
+	"Usage: chip8 [options] ROM\n"
+	"  --help           Show this message\n"
+	"  --hz N           Instructions per second (default 600)\n"
+	"  --run-ahead N    Show the screen N frames ahead to hide input lag\n"
+	"Hold Tab to run as fast as possible.\n";
+
 /* TODO: These command line options should be available:
-	--help
 	--width
 	--height
-	--cycle-delay
 	--wrapping-gfx
 	--no-audio
 	--no-message-boxes
@@ -126,15 +152,93 @@ u8 keypad_from_sdl_scancode(SDL_Scancode k)
 	}
 }
 
-int front_main(int argc, char *argv[])
+// The instruction clock rarely divides evenly into 60 Hz, so frames get their
+// share of a second's cycles in turn.
+static uint frame_cycles(u64 frame, ulong hz)
 {
-	if (argc == 1)
-		RET_ERROR("Argument error", "Must specify a ROM to read.");
+	return (frame + 1) * hz / 60 - frame * hz / 60;
+}
+
+// Runs the next emulated frame.
+static int run_frame(u64 *frames, ulong hz)
+{
+	const enum chip8_interrupt in =
+		runner_frame(&runner, frame_cycles((*frames)++, hz));
+	const struct chip8 *emu = &runner.emu;
+	switch (in) {
+	case CHIP8_OK:
+		return 0;
+	case CHIP8_BAD_INSTRUCTION:
+		RET_ERROR(
+			"Invalid Instruction",
+			"Invalid instruction encountered: 0x%04X",
+			emu->mem[emu->pc] << 8 | emu->mem[emu->pc + 1]);
+	default:
+		RET_ERROR("Unrecoverable Interrupt", chip8_interrupt_desc(in));
+	}
+}
+
+// Presents the screen as it will be 'n' frames from now if the keys stay as
+// they are, then rolls back to the real state. Many games only react to a key
+// a frame or more after reading it; this hides that lag.
+static int present_ahead(SDL_Renderer *renderer, u64 frames, ulong hz, uint n)
+{
+	real = runner;
+	for (uint f = 0; f < n; f++)
+		// Errors are reported when the real state gets there.
+		if (runner_frame(&runner, frame_cycles(frames + f, hz)) != CHIP8_OK)
+			break;
+	int res = redraw(renderer, &runner.emu);
+	runner = real;
+	return res;
+}
 
-	if (argc > 2)
-		RET_ERROR("Argument error", "Only one argument expected.");
+// Parses a decimal number up to 'max'. Unlike plain strtoul, rejects signs,
+// leading whitespace and values that do not fit.
+static bool parse_count(const char *arg, ulong max, ulong *out)
+{
+	if (!arg || !isdigit((unsigned char)arg[0]))
+		return false;
+	char *end;
+	errno = 0;
+	const ulong v = strtoul(arg, &end, 10);
+	if (*end || errno || v > max)
+		return false;
+	*out = v;
+	return true;
+}
+
+int front_main(int argc, char *argv[])
+{
+	const char *rompath = NULL;
+	ulong hz = DEFAULT_HZ;
+	ulong run_ahead = 0;
+
+	for (int a = 1; a < argc; a++) {
+		if (!strcmp(argv[a], "--help")) {
+			fputs(usage, stdout);
+			return 0;
+		} else if (!strcmp(argv[a], "--hz")) {
+			if (!parse_count(argv[++a], MAX_HZ, &hz) || hz == 0)
+				RET_ERROR(
+					"Argument error",
+					"--hz expects a number from 1 to %d.",
+					MAX_HZ);
+		} else if (!strcmp(argv[a], "--run-ahead")) {
+			if (!parse_count(argv[++a], MAX_RUN_AHEAD, &run_ahead))
+				RET_ERROR(
+					"Argument error",
+					"--run-ahead expects a number of frames up to %d.",
+					MAX_RUN_AHEAD);
+		} else if (rompath) {
+			RET_ERROR("Argument error", "Only one ROM expected.");
+		} else {
+			rompath = argv[a];
+		}
+	}
 
-	const char *rompath = argv[1];
+	if (!rompath)
+		RET_ERROR("Argument error", "Must specify a ROM to read.");
 
 	FILE *rom = fopen(rompath, "rb");
 
@@ -170,6 +274,10 @@ int front_main(int argc, char *argv[])
 	int win_width = display_mode.w / 2;
 	int win_height = display_mode.h / 2;
 
+	// Never present more often than the display can show.
+	const u32 refresh_ms =
+		1000 / (display_mode.refresh_rate > 0 ? display_mode.refresh_rate : 60);
+
 	SDL_Window *window = SDL_CreateWindow(
 		rompath,
 		SDL_WINDOWPOS_CENTERED,
@@ -191,21 +299,19 @@ int front_main(int argc, char *argv[])
 		RET_ERROR(
 			"SDL Error", "Failed to set render scale: %s", SDL_GetError());
 
-	u32 mulberry32 = time(NULL);
-	u32 delay_timer_ms = SDL_GetTicks();
-	bool need_keypress = false;
 	bool fullscreen = false;
+	bool turbo = false;
 
-#ifndef NDEBUG
-	u16 history[64] = {0};
-#endif
+	runner_init(&runner, rom_buffer, rom_size, time(NULL));
 
-	chip8_init(&chip8, rom_buffer, rom_size);
+	// Emulated time is 'frames' 60 Hz frames since 'start_ms' of wall time.
+	// Timers run off emulated time, so they stay in step with the program
+	// in turbo mode and when frames are skipped.
+	u64 frames = 0;
+	u32 start_ms = SDL_GetTicks();
+	u32 present_ms = start_ms;
 
 	while (1) {
-		// TODO: configurable cycle delay.
-		SDL_Delay(1); // 16.666ms == 60hz
-
 		SDL_Event event;
 
 		while (SDL_PollEvent(&event)) {
@@ -214,10 +320,14 @@ int front_main(int argc, char *argv[])
 				return 0;
 
 			case SDL_KEYUP: {
+				if (event.key.keysym.sym == SDLK_TAB) {
+					turbo = false;
+					break;
+				}
 				u8 k = keypad_from_sdl_scancode(event.key.keysym.scancode);
 				if (k == 0xFF)
 					break; // Irrelevant key
-				chip8.keys &= ~(1 << k);
+				runner.emu.keys &= ~(1 << k);
 				break;
 			}
 
@@ -227,6 +337,12 @@ int front_main(int argc, char *argv[])
 				if (keysym.sym == SDLK_ESCAPE)
 					return 0;
 
+				// Run uncapped while held.
+				if (keysym.sym == SDLK_TAB) {
+					turbo = true;
+					break;
+				}
+
 				// Toggle Fullscreen
 				if (keysym.sym == SDLK_F11) {
 					if (SDL_SetWindowFullscreen(
@@ -246,7 +362,7 @@ int front_main(int argc, char *argv[])
 					printf("fullscreen: %s\n", fullscreen ? "true" : "false");
 
 					SDL_RenderSetScale(renderer, w / 64.f, l / 32.f);
-					int res = redraw(renderer, &chip8);
+					int res = redraw(renderer, &runner.emu);
 
 					if (res)
 						return res;
@@ -258,13 +374,12 @@ int front_main(int argc, char *argv[])
 				if (kp == 0xFF)
 					break; // Irrelevant key
 
-				if (need_keypress) {
-					chip8_supply_key(&chip8, kp);
-					need_keypress = false;
+				if (runner.need_key) {
+					runner_supply_key(&runner, kp);
 					break;
 				}
 
-				chip8.keys |= 1 << kp;
+				runner.emu.keys |= 1 << kp;
 				break;
 			}
 
@@ -277,7 +392,7 @@ int front_main(int argc, char *argv[])
 					event.window.data1 / 64.f,
 					event.window.data2 / 32.f);
 
-				int res = redraw(renderer, &chip8);
+				int res = redraw(renderer, &runner.emu);
 				if (res)
 					return res;
 				break;
@@ -285,67 +400,57 @@ int front_main(int argc, char *argv[])
 			}
 		}
 
-		if (need_keypress)
-			continue;
-
-		// CYCLE
-		const enum chip8_interrupt in = chip8_cycle(&chip8);
-		switch (in) {
-		case CHIP8_OK:
-			break;
+		u32 now = SDL_GetTicks();
+		const u64 frames_before = frames;
 
-		case CHIP8_NEED_RAND: {
-			// mulberry32 PRNG algorithm
-			u32 z = (mulberry32 += 0x6D2B79F5UL);
-			z = (z ^ (z >> 15)) * (z | 1UL);
-			z ^= z + (z ^ (z >> 7)) * (z | 61UL);
-			z = z ^ (z >> 14);
-			// Use top 8 bits of z
-			chip8_supply_rand(&chip8, z >> 24);
-			break;
+		if (turbo) {
+			// Emulate as many frames as fit in one display refresh.
+			do {
+				int res = run_frame(&frames, hz);
+				if (res)
+					return res;
+			} while (!runner.need_key && SDL_GetTicks() - now < refresh_ms);
+
+			// Carry on from here at normal speed once turbo is released.
+			now = SDL_GetTicks();
+			start_ms = now - (u32)(frames * 1000 / 60);
+		} else {
+			u64 due = (u64)(now - start_ms) * 60 / 1000;
+			if (due > frames + MAX_CATCHUP_FRAMES) {
+				const u64 skipped = due - frames - MAX_CATCHUP_FRAMES;
+				start_ms += (u32)(skipped * 1000 / 60);
+				due = frames + MAX_CATCHUP_FRAMES;
+			}
+			// Frame skip: every due frame is emulated but only the last one
+			// is presented.
+			while (frames < due) {
+				int res = run_frame(&frames, hz);
+				if (res)
+					return res;
+			}
 		}
 
-		case CHIP8_NEED_KEY:
-			need_keypress = true;
-			break;
+		// The screen ahead can change with every frame, drawn to or not.
+		if (run_ahead && frames != frames_before)
+			runner.dirty = true;
 
-		case CHIP8_GFX_CLEAR:
-		case CHIP8_GFX_DRAW: {
-			int res = redraw(renderer, &chip8);
+		if (runner.dirty && now - present_ms >= refresh_ms) {
+			runner.dirty = false;
+			present_ms = now;
+			int res = run_ahead && !turbo
+				? present_ahead(renderer, frames, hz, run_ahead)
+				: redraw(renderer, &runner.emu);
 			if (res)
 				return res;
-			break;
 		}
 
-		case CHIP8_DELAY_TIMER_WRITE:
-			delay_timer_ms = SDL_GetTicks();
-
-		case CHIP8_NEED_DELAY_TIMER: {
-			// One chip8 tick is 1/60th of a second.
-			long ticks_since = chip8.dtimer_buf -
-				lroundf((SDL_GetTicks() - delay_timer_ms) / (1000.f / 60.f));
-			chip8_supply_delay_timer(&chip8, ticks_since < 0 ? 0 : ticks_since);
-			break;
-		}
-
-		case CHIP8_SOUND_TIMER_WRITE:
-			// TODO: set sound timer (SDL_AddTimer?)
-			break;
-
-		case CHIP8_BAD_INSTRUCTION:
-			RET_ERROR(
-				"Invalid Instruction",
-				"Invalid instruction encountered: 0x%04" PRIX16,
-				chip8.mem[chip8.pc]);
-		default:
-			RET_ERROR("Unrecoverable Interrupt", chip8_interrupt_desc(in));
+		if (!turbo) {
+			// Sleep until the next frame is due.
+			const u32 next_ms = start_ms + (u32)((frames + 1) * 1000 / 60);
+			now = SDL_GetTicks();
+			if ((i32)(next_ms - now) > 0)
+				SDL_Delay(next_ms - now);
 		}
-#ifndef NDEBUG
-		// shift one item back and set last item.
-		memmove(history, history + 1, ARRAY_LEN(history) - 1);
-		history[ARRAY_LEN(history) - 1] =
-			chip8.mem[chip8.pc] << 8 | chip8.mem[chip8.pc + 1];
-#endif
 	}
 
 	SDL_DestroyRenderer(renderer);
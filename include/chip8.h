@@ -64,11 +64,20 @@ enum chip8_interrupt {
 	CHIP8_OOB_BCD,
 	CHIP8_OOB_REGWRITE,
 	CHIP8_OOB_REGREAD,
+	CHIP8_OUT_OF_MEMORY,
 };
 
 // Advances the state of the emulator by one instruction.
 enum chip8_interrupt chip8_cycle(struct chip8 *);
 
+// Size in bytes of a frame buffer packed by chip8_pack_fb.
+#define CHIP8_PACKED_FB_SIZE (64 * 32 / 8)
+
+// Packs the frame buffer one bit per pixel into 'out', row by row.
+// Each row is 8 bytes and the most significant bit of a byte is the leftmost
+// pixel, the same layout sprites use.
+void chip8_pack_fb(const struct chip8 *, uint8_t out[CHIP8_PACKED_FB_SIZE]);
+
 // Returns a string description of a chip8_interrupt
 const char *chip8_interrupt_desc(enum chip8_interrupt);
 
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Static analysis of chip8 ROMs.
+//
+// Follows every path from 0x200 without running the ROM, decoding
+// instructions the same way chip8_cycle does. The result tells code from
+// data, recovers the control flow graph and flags stores that may overwrite
+// code, so a host can tell up front whether a ROM is safe to run on anything
+// smarter than the plain interpreter.
+
+enum chip8_op {
+	// Anything chip8_cycle answers with CHIP8_BAD_INSTRUCTION, SYS included.
+	CHIP8_OP_INVALID,
+	CHIP8_OP_CLS, // 00E0
+	CHIP8_OP_RET, // 00EE
+	CHIP8_OP_JP, // 1NNN
+	CHIP8_OP_CALL, // 2NNN
+	CHIP8_OP_SE_NN, // 3XNN
+	CHIP8_OP_SNE_NN, // 4XNN
+	CHIP8_OP_SE, // 5XY0
+	CHIP8_OP_LD_NN, // 6XNN
+	CHIP8_OP_ADD_NN, // 7XNN
+	CHIP8_OP_LD, // 8XY0
+	CHIP8_OP_OR, // 8XY1
+	CHIP8_OP_AND, // 8XY2
+	CHIP8_OP_XOR, // 8XY3
+	CHIP8_OP_ADD, // 8XY4
+	CHIP8_OP_SUB, // 8XY5
+	CHIP8_OP_SHR, // 8XY6
+	CHIP8_OP_SUBN, // 8XY7
+	CHIP8_OP_SHL, // 8XYE
+	CHIP8_OP_SNE, // 9XY0
+	CHIP8_OP_LD_I, // ANNN
+	CHIP8_OP_JP_V0, // BNNN
+	CHIP8_OP_RND, // CXNN
+	CHIP8_OP_DRW, // DXYN
+	CHIP8_OP_SKP, // EX9E
+	CHIP8_OP_SKNP, // EXA1
+	CHIP8_OP_LD_VX_DT, // FX07
+	CHIP8_OP_LD_VX_K, // FX0A
+	CHIP8_OP_LD_DT_VX, // FX15
+	CHIP8_OP_LD_ST_VX, // FX18
+	CHIP8_OP_ADD_I_VX, // FX1E
+	CHIP8_OP_LD_F_VX, // FX29
+	CHIP8_OP_LD_B_VX, // FX33
+	CHIP8_OP_LD_MEM_VX, // FX55
+	CHIP8_OP_LD_VX_MEM, // FX65
+};
+
+// A decoded instruction. Fields the opcode does not use are still filled in
+// from their nibbles.
+struct chip8_insn {
+	enum chip8_op op;
+	uint8_t x;
+	uint8_t y;
+	uint8_t n;
+	uint8_t nn;
+	uint16_t nnn;
+};
+
+struct chip8_insn chip8_decode(uint16_t ins);
+
+// Writes assembly for an instruction into 'buf', like snprintf.
+int chip8_format_insn(char *buf, size_t len, struct chip8_insn);
+
+// What the analysis found out about a byte of memory.
+enum chip8_byte_flags {
+	// An instruction starts here.
+	CHIP8_BYTE_CODE = 1 << 0,
+	// The second byte of an instruction.
+	CHIP8_BYTE_CODE_TAIL = 1 << 1,
+	// Read as a sprite by DXYN.
+	CHIP8_BYTE_SPRITE = 1 << 2,
+	// Read by FX65.
+	CHIP8_BYTE_READ = 1 << 3,
+	// Written by FX33 or FX55.
+	CHIP8_BYTE_WRITTEN = 1 << 4,
+	// The target of a jump or a skip.
+	CHIP8_BYTE_JUMP_TARGET = 1 << 5,
+	// The start of a subroutine.
+	CHIP8_BYTE_CALL_TARGET = 1 << 6,
+};
+
+enum chip8_edge_kind {
+	// The next instruction, including the one after a CALL returns.
+	CHIP8_EDGE_NEXT,
+	// The instruction after a skipped one.
+	CHIP8_EDGE_SKIP,
+	CHIP8_EDGE_JUMP,
+	CHIP8_EDGE_CALL,
+};
+
+// A straight run of instructions that is only entered at its start.
+struct chip8_block {
+	uint16_t start;
+	// The address just past the last instruction.
+	uint16_t end;
+	// The last instruction is RET, BNNN or invalid, or runs off memory.
+	bool exits;
+};
+
+struct chip8_edge {
+	// The start of the block the edge leaves.
+	uint16_t from;
+	uint16_t to;
+	enum chip8_edge_kind kind;
+};
+
+// The most values of I the analysis keeps apart before it gives up on I.
+#define CHIP8_ANALYZE_MAX_I 4
+
+// A reachable FX33 or FX55.
+struct chip8_store {
+	uint16_t pc;
+	// The values I may hold when it runs. 'ni' is zero when I is not known.
+	uint8_t ni;
+	uint16_t i[CHIP8_ANALYZE_MAX_I];
+	// Bytes written from I onwards.
+	uint8_t len;
+	// The store may overwrite code. Always true when I is not known.
+	bool hits_code;
+};
+
+struct chip8_analysis {
+	// Memory as analyzed: the font and the ROM laid out by chip8_init.
+	uint8_t mem[0x1000];
+	uint8_t flags[0x1000];
+	struct chip8_block *blocks;
+	size_t nblocks;
+	struct chip8_edge *edges;
+	size_t nedges;
+	struct chip8_store *stores;
+	size_t nstores;
+	// Addresses of reachable BNNN, whose targets depend on V0.
+	uint16_t *dynamic_jumps;
+	size_t ndynamic_jumps;
+	// Addresses of reachable instructions chip8_cycle rejects.
+	uint16_t *invalid;
+	size_t ninvalid;
+	// No store may overwrite code and every jump target is known.
+	// Such a ROM never executes anything the analysis did not see.
+	bool static_code;
+};
+
+// Analyzes a ROM as chip8_init would load it.
+// Returns false when out of memory.
+bool chip8_analyze(const uint8_t *rom, size_t sz, struct chip8_analysis *);
+
+void chip8_analysis_free(struct chip8_analysis *);
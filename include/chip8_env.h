@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// A batched environment API for training agents on CHIP-8 ROMs.
+//
+// Each environment runs one ROM headless. A step holds the keys given by the
+// action for a fixed number of 60 Hz frames, then reports the screen, the
+// change in score and whether the episode is over. Timers run in emulated
+// time and random numbers come from a seeded generator, so an episode is
+// reproducible from its seed and actions.
+
+// How the score bytes of a ROM are encoded.
+enum chip8_score_format {
+	// One decimal digit per byte, most significant first, as written by Fx33.
+	CHIP8_SCORE_BCD,
+	// A big endian binary number.
+	CHIP8_SCORE_BINARY,
+};
+
+struct chip8_env_config {
+	const uint8_t *rom;
+	size_t rom_size;
+	// Instructions per 60 Hz frame.
+	unsigned cycles_per_frame;
+	// 60 Hz frames per step.
+	unsigned frames_per_step;
+	// An episode ends after this many steps. Zero for no limit.
+	unsigned max_steps;
+	// The seed of the first episode. Every reset moves on to a new seed.
+	uint32_t seed;
+	// The reward of a step is how much the score in memory went up.
+	// Set score_len to zero for no rewards.
+	uint16_t score_addr;
+	uint8_t score_len;
+	enum chip8_score_format score_format;
+};
+
+struct chip8_env;
+
+// Creates an environment, already in its first episode. The ROM is copied.
+// Returns NULL when out of memory or when the config is invalid.
+struct chip8_env *chip8_env_create(const struct chip8_env_config *);
+
+void chip8_env_destroy(struct chip8_env *);
+
+// Starts a new episode in each of the 'n' environments.
+// Resetting a new environment before its first step keeps the first seed.
+void chip8_env_reset(struct chip8_env *const *envs, size_t n);
+
+// Threads that chip8_env_step can spread a batch across.
+struct chip8_env_threads;
+
+// Steps each of the 'n' environments once.
+// actions[e] is the key state to hold, one bit per key like chip8.keys.
+// Writes n * CHIP8_PACKED_FB_SIZE bytes of packed screens to 'obs' (see
+// chip8_pack_fb), then n rewards and n done flags.
+// An environment that reported done starts a new episode on its next step.
+// The batch is spread across 'threads', or stepped on the calling thread when
+// it is NULL.
+void chip8_env_step(
+	struct chip8_env *const *envs,
+	const uint16_t *actions,
+	size_t n,
+	uint8_t *obs,
+	float *rewards,
+	bool *dones,
+	struct chip8_env_threads *threads);
+
+// Starts 'n' threads for chip8_env_step, 0 for one per CPU. The calling
+// thread counts as one of them. Returns NULL if they could not be started.
+// A set of threads runs one chip8_env_step at a time; give each independent
+// batch that steps concurrently its own.
+struct chip8_env_threads *chip8_env_threads_create(unsigned n);
+
+void chip8_env_threads_destroy(struct chip8_env_threads *);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip8.h"
+
+// Instances of the same ROM that share one read-only memory image.
+//
+// Memory is split into pages. An instance reads every page from the pool's
+// image until it first writes to it, at which point it gets a private copy
+// of just that page. Most ROMs only ever write to a handful of pages, so an
+// instance costs little more than its registers and frame buffer.
+//
+// Instances may run on different threads, but must not be copied: two copies
+// would share private pages.
+//
+// This is library API only; none of the bundled tools use it yet.
+
+#define CHIP8_PAGE_SIZE 256
+#define CHIP8_PAGE_COUNT (4096 / CHIP8_PAGE_SIZE)
+
+struct chip8_pool;
+
+// Holds the state of a chip8 emulator whose memory lives in a pool.
+// The same as struct chip8 apart from how memory is stored.
+struct chip8_inst {
+	bool gfx_wrapping;
+	uint8_t v[16];
+	uint16_t i;
+	uint16_t pc;
+	uint16_t sas[16];
+	uint8_t sp;
+	uint16_t keys;
+	uint8_t dtimer_buf;
+	uint8_t stimer_buf;
+	// Bit n is set when page n is a private copy.
+	uint16_t private_pages;
+	struct chip8_pool *pool;
+	// Points either into the pool's image or to a private copy.
+	const uint8_t *page[CHIP8_PAGE_COUNT];
+	uint8_t fb[64][32];
+};
+
+// Creates a pool for a ROM. Returns NULL when out of memory.
+struct chip8_pool *chip8_pool_create(const uint8_t *rom, size_t sz);
+
+// Frees a pool. Every instance must have been released first.
+void chip8_pool_destroy(struct chip8_pool *);
+
+// Returns the number of private pages held by all instances of a pool.
+size_t chip8_pool_private_pages(const struct chip8_pool *);
+
+// Initializes an instance as if by chip8_init with the pool's ROM.
+void chip8_inst_init(struct chip8_inst *, struct chip8_pool *);
+
+// Frees the private pages of an instance.
+// Call this before reinitializing or discarding it.
+void chip8_inst_release(struct chip8_inst *);
+
+// Returns the byte at address 'addr' in the range [0, 0xFFF].
+uint8_t chip8_inst_peek(const struct chip8_inst *, uint16_t addr);
+
+// Same as their chip8_ counterparts.
+// chip8_inst_cycle returns CHIP8_OUT_OF_MEMORY when it could not allocate a
+// private page. The instruction can be retried.
+enum chip8_interrupt chip8_inst_cycle(struct chip8_inst *);
+void chip8_inst_supply_rand(struct chip8_inst *, uint8_t r);
+void chip8_inst_supply_key(struct chip8_inst *, uint8_t k);
+void chip8_inst_supply_delay_timer(struct chip8_inst *, uint8_t t);
@@ -0,0 +1,3 @@
+int server_main(int, char *[]);
+
+int main(int argc, char *argv[]) { return server_main(argc, argv); }
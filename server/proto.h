@@ -0,0 +1,60 @@
+#pragma once
+
+// Wire protocol of chip8-server.
+//
+// Every message starts with an 8 byte header followed by 'len' payload bytes.
+// All integers are little endian.
+//
+//   offset  size  field
+//   0       1     type (enum proto_type)
+//   1       1     reserved, must be zero
+//   2       2     session
+//   4       4     len
+//
+// A client creates sessions with PROTO_CREATE and refers to them by the
+// session number in PROTO_CREATED. A session only lives as long as the
+// connection that created it.
+//
+// Once per emulated frame the server sends a PROTO_FRAME for every session
+// whose screen changed. The payload is a 4 byte frame number followed by
+// (offset, byte) pairs. 'offset' indexes the frame buffer packed by
+// chip8_pack_fb and 'byte' is its new value. Pairs for bytes that did not
+// change since the previous frame are left out; the screen of a new
+// session starts out blank.
+//
+// When more than half of the screen changed the pairs would outgrow the
+// screen itself, so the server sends a PROTO_FULL_FRAME instead. Its payload
+// is the 4 byte frame number followed by the whole CHIP8_PACKED_FB_SIZE byte
+// packed frame buffer.
+
+#include <stdint.h>
+
+#define PROTO_HEADER_SIZE 8
+
+// The largest payload either side will accept.
+#define PROTO_MAX_PAYLOAD 0x1000
+
+enum proto_type {
+	// client -> server
+
+	// Payload: the ROM image.
+	PROTO_CREATE = 1,
+	// Payload: 2 byte key state, one bit per key like chip8.keys.
+	PROTO_KEYS = 2,
+	// No payload.
+	PROTO_DESTROY = 3,
+
+	// server -> client
+
+	// Reply to PROTO_CREATE. The header holds the new session number.
+	PROTO_CREATED = 0x81,
+	// Payload: frame number and packed frame buffer changes (see above).
+	PROTO_FRAME = 0x82,
+	// The session stopped. It must still be destroyed by the client.
+	// Payload: 1 byte chip8_interrupt, 2 byte PC, then a description.
+	PROTO_HALTED = 0x83,
+	// A request failed. Payload: an error message.
+	PROTO_ERROR = 0x84,
+	// Payload: frame number and the whole packed frame buffer (see above).
+	PROTO_FULL_FRAME = 0x85,
+};
@@ -0,0 +1,671 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/defs.h"
+#include "../src/runner.h"
+#include "../src/workers.h"
+#include "chip8.h"
+#include "proto.h"
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+#define RET_ERROR(...) \
+	do { \
+		fprintf(stderr, __VA_ARGS__); \
+		putc('\n', stderr); \
+		return __LINE__; \
+	} while (0)
+
+// Session numbers are 16 bits on the wire.
+#define MAX_SESSIONS 0x10000
+
+// A client that falls this far behind on reading frames is dropped.
+#define MAX_PENDING_OUTPUT (1 << 20)
+
+// When the event loop falls behind the 60 Hz timer, at most this many frames
+// are run to catch up. The rest are dropped.
+#define MAX_CATCHUP_FRAMES 4
+
+// The most instructions per second --hz accepts.
+#define MAX_HZ 1000000
+
+// The most worker threads --threads accepts.
+#define MAX_THREADS 1024
+
+struct client {
+	int fd;
+	// Bytes of a partially received message.
+	u8 in[PROTO_HEADER_SIZE + PROTO_MAX_PAYLOAD];
+	size_t in_len;
+	// Bytes queued for sending.
+	u8 *out;
+	size_t out_len;
+	size_t out_cap;
+	// EPOLLOUT is registered because the socket buffer filled up.
+	bool polling_out;
+	// The connection failed or broke the protocol. Freed by the event loop.
+	bool dead;
+	struct client *next_dead;
+};
+
+struct session {
+	struct runner r;
+	struct client *owner;
+	u16 id;
+	// Index into server.active.
+	size_t slot;
+	// The emulator stopped on an unrecoverable interrupt.
+	bool halted;
+	bool halt_reported;
+	enum chip8_interrupt fault;
+	u32 frame;
+	// The packed frame buffer as last sent to the client.
+	u8 shown[CHIP8_PACKED_FB_SIZE];
+	// Changes made by the last frame as (offset, byte) pairs.
+	u8 delta[2 * CHIP8_PACKED_FB_SIZE];
+	uint delta_len;
+	// The delta is larger than the screen; send all of 'shown' instead.
+	bool send_full;
+};
+
+static struct {
+	int epoll_fd;
+	int listen_fd;
+	int timer_fd;
+	int signal_fd;
+	struct workers *workers;
+	// Instructions per second per session.
+	ulong hz;
+	struct session *by_id[MAX_SESSIONS];
+	// Every live session, in no particular order.
+	struct session **active;
+	size_t nactive;
+	// The lowest session number that might be free.
+	uint next_id;
+	// Clients to free once the current batch of events is handled.
+	struct client *dead;
+} server;
+
+static void put_u16(u8 *p, u16 v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put_u32(u8 *p, u32 v)
+{
+	put_u16(p, v);
+	put_u16(p + 2, v >> 16);
+}
+
+static u16 get_u16(const u8 *p) { return p[0] | p[1] << 8; }
+
+static u32 get_u32(const u8 *p)
+{
+	return get_u16(p) | (u32)get_u16(p + 2) << 16;
+}
+
+static void drop(struct client *c)
+{
+	if (c->dead)
+		return;
+	c->dead = true;
+	c->next_dead = server.dead;
+	server.dead = c;
+}
+
+static void watch_output(struct client *c, bool on)
+{
+	if (c->polling_out == on)
+		return;
+	struct epoll_event ev = {
+		.events = EPOLLIN | (on ? EPOLLOUT : 0),
+		.data.ptr = c,
+	};
+	if (epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, c->fd, &ev))
+		drop(c);
+	c->polling_out = on;
+}
+
+static void flush(struct client *c)
+{
+	size_t sent = 0;
+	while (sent < c->out_len) {
+		const ssize_t n =
+			send(c->fd, c->out + sent, c->out_len - sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				drop(c);
+			break;
+		}
+		sent += n;
+	}
+	memmove(c->out, c->out + sent, c->out_len - sent);
+	c->out_len -= sent;
+	watch_output(c, c->out_len != 0);
+}
+
+// Queues a message. It is sent by the next flush.
+static void queue(
+	struct client *c,
+	enum proto_type type,
+	u16 session,
+	const void *payload,
+	size_t len)
+{
+	if (c->dead)
+		return;
+
+	const size_t need = c->out_len + PROTO_HEADER_SIZE + len;
+	if (need > MAX_PENDING_OUTPUT) {
+		fprintf(stderr, "Dropping client %d: not reading.\n", c->fd);
+		drop(c);
+		return;
+	}
+	if (need > c->out_cap) {
+		size_t cap = c->out_cap ? c->out_cap : 4096;
+		while (cap < need)
+			cap *= 2;
+		u8 *out = realloc(c->out, cap);
+		if (!out) {
+			drop(c);
+			return;
+		}
+		c->out = out;
+		c->out_cap = cap;
+	}
+
+	u8 *p = c->out + c->out_len;
+	p[0] = type;
+	p[1] = 0;
+	put_u16(p + 2, session);
+	put_u32(p + 4, len);
+	if (len)
+		memcpy(p + PROTO_HEADER_SIZE, payload, len);
+	c->out_len = need;
+}
+
+static void queue_error(struct client *c, u16 session, const char *msg)
+{
+	queue(c, PROTO_ERROR, session, msg, strlen(msg));
+}
+
+static void create_session(struct client *c, const u8 *rom, size_t sz)
+{
+	if (sz > CHIP8_MAX_ROM_SIZE) {
+		queue_error(c, 0, "ROM exceeds the maximum ROM size.");
+		return;
+	}
+
+	uint id = server.next_id;
+	while (id < MAX_SESSIONS && server.by_id[id])
+		id++;
+	if (id == MAX_SESSIONS) {
+		queue_error(c, 0, "Too many sessions.");
+		return;
+	}
+
+	struct session **active =
+		realloc(server.active, (server.nactive + 1) * sizeof *active);
+	if (!active) {
+		queue_error(c, 0, "Out of memory.");
+		return;
+	}
+	server.active = active;
+
+	struct session *s = malloc(sizeof *s);
+	if (!s) {
+		queue_error(c, 0, "Out of memory.");
+		return;
+	}
+
+	runner_init(&s->r, rom, sz, (u32)time(NULL) ^ id * 0x9E3779B9UL);
+	s->owner = c;
+	s->id = id;
+	s->slot = server.nactive;
+	s->halted = false;
+	s->halt_reported = false;
+	s->fault = CHIP8_OK;
+	s->frame = 0;
+	memset(s->shown, 0, sizeof s->shown);
+	s->delta_len = 0;
+	s->send_full = false;
+
+	server.active[server.nactive++] = s;
+	server.by_id[id] = s;
+	server.next_id = id + 1;
+
+	queue(c, PROTO_CREATED, id, NULL, 0);
+}
+
+static void destroy_session(struct session *s)
+{
+	struct session *last = server.active[--server.nactive];
+	server.active[s->slot] = last;
+	last->slot = s->slot;
+
+	server.by_id[s->id] = NULL;
+	if (s->id < server.next_id)
+		server.next_id = s->id;
+	free(s);
+}
+
+static void set_keys(struct session *s, u16 keys)
+{
+	struct runner *r = &s->r;
+	const u16 pressed = keys & ~r->emu.keys;
+	r->emu.keys = keys;
+
+	// A key that goes down answers a pending LD VX, K.
+	if (r->need_key && pressed) {
+		u8 k = 0;
+		while (!(pressed & 1 << k))
+			k++;
+		runner_supply_key(r, k);
+	}
+}
+
+// Looks up a session, making sure it belongs to the client.
+static struct session *find_session(struct client *c, u16 id)
+{
+	struct session *s = server.by_id[id];
+	if (!s || s->owner != c) {
+		queue_error(c, id, "No such session.");
+		return NULL;
+	}
+	return s;
+}
+
+static void handle_message(
+	struct client *c,
+	u8 type,
+	u16 id,
+	const u8 *payload,
+	size_t len)
+{
+	struct session *s;
+
+	switch (type) {
+	case PROTO_CREATE:
+		create_session(c, payload, len);
+		break;
+
+	case PROTO_KEYS:
+		if (len != 2) {
+			queue_error(c, id, "Bad key state.");
+			return;
+		}
+		if ((s = find_session(c, id)))
+			set_keys(s, get_u16(payload));
+		break;
+
+	case PROTO_DESTROY:
+		if ((s = find_session(c, id)))
+			destroy_session(s);
+		break;
+
+	default:
+		queue_error(c, id, "Unknown message type.");
+		drop(c);
+		break;
+	}
+}
+
+static void receive(struct client *c)
+{
+	while (!c->dead) {
+		const ssize_t n =
+			recv(c->fd, c->in + c->in_len, sizeof c->in - c->in_len, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				drop(c);
+			break;
+		}
+		if (n == 0) {
+			drop(c);
+			break;
+		}
+		c->in_len += n;
+
+		// Handle every complete message in the buffer.
+		size_t off = 0;
+		while (!c->dead && c->in_len - off >= PROTO_HEADER_SIZE) {
+			const u8 *h = c->in + off;
+			const u32 len = get_u32(h + 4);
+			if (len > PROTO_MAX_PAYLOAD) {
+				queue_error(c, 0, "Message too large.");
+				drop(c);
+				break;
+			}
+			if (c->in_len - off < PROTO_HEADER_SIZE + len)
+				break;
+			handle_message(
+				c, h[0], get_u16(h + 2), h + PROTO_HEADER_SIZE, len);
+			off += PROTO_HEADER_SIZE + len;
+		}
+		memmove(c->in, c->in + off, c->in_len - off);
+		c->in_len -= off;
+	}
+	flush(c);
+}
+
+static void accept_clients(void)
+{
+	while (1) {
+		const int fd = accept(server.listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				perror("accept");
+			return;
+		}
+
+		struct client *c = calloc(1, sizeof *c);
+		if (!c || fcntl(fd, F_SETFL, O_NONBLOCK)) {
+			free(c);
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+		if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+			perror("epoll_ctl");
+			free(c);
+			close(fd);
+		}
+	}
+}
+
+static void close_client(struct client *c)
+{
+	for (size_t i = server.nactive; i-- > 0;)
+		if (server.active[i]->owner == c)
+			destroy_session(server.active[i]);
+
+	epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	free(c->out);
+	free(c);
+}
+
+// Runs one frame of a session on a worker thread.
+// Only touches the session itself.
+static void step_session(void *ctx, size_t i)
+{
+	struct session *s = ((struct session **)ctx)[i];
+	s->delta_len = 0;
+	s->send_full = false;
+	if (s->halted)
+		return;
+
+	// Spreads hz over the frames of a second when it is no multiple of 60.
+	const u64 f = s->frame;
+	const uint cycles = (f + 1) * server.hz / 60 - f * server.hz / 60;
+	const enum chip8_interrupt in = runner_frame(&s->r, cycles);
+	if (in != CHIP8_OK) {
+		s->halted = true;
+		s->fault = in;
+	}
+	s->frame++;
+
+	if (!s->r.dirty)
+		return;
+	s->r.dirty = false;
+
+	u8 packed[CHIP8_PACKED_FB_SIZE];
+	chip8_pack_fb(&s->r.emu, packed);
+	for (uint b = 0; b < ARRAY_LEN(packed); b++) {
+		if (packed[b] == s->shown[b])
+			continue;
+		s->delta[s->delta_len++] = b;
+		s->delta[s->delta_len++] = packed[b];
+		s->shown[b] = packed[b];
+	}
+	s->send_full = s->delta_len > sizeof packed;
+}
+
+static void run_frame(void)
+{
+	workers_run(server.workers, step_session, server.active, server.nactive);
+
+	u8 buf[4 + sizeof server.active[0]->delta];
+	for (size_t i = 0; i < server.nactive; i++) {
+		struct session *s = server.active[i];
+
+		if (s->send_full) {
+			put_u32(buf, s->frame);
+			memcpy(buf + 4, s->shown, sizeof s->shown);
+			queue(s->owner, PROTO_FULL_FRAME, s->id, buf,
+			      4 + sizeof s->shown);
+		} else if (s->delta_len) {
+			put_u32(buf, s->frame);
+			memcpy(buf + 4, s->delta, s->delta_len);
+			queue(s->owner, PROTO_FRAME, s->id, buf, 4 + s->delta_len);
+		}
+
+		if (s->halted && !s->halt_reported) {
+			const char *desc = chip8_interrupt_desc(s->fault);
+			const size_t len = strlen(desc);
+			buf[0] = s->fault;
+			put_u16(buf + 1, s->r.emu.pc);
+			memcpy(buf + 3, desc, len);
+			queue(s->owner, PROTO_HALTED, s->id, buf, 3 + len);
+			s->halt_reported = true;
+		}
+	}
+}
+
+static int listen_on(const char *path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof addr.sun_path)
+		RET_ERROR("Socket path too long: %s", path);
+	strcpy(addr.sun_path, path);
+
+	server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server.listen_fd < 0)
+		RET_ERROR("Failed to create socket: %s", strerror(errno));
+
+	// Remove the socket left behind by a previous run.
+	unlink(path);
+
+	if (bind(server.listen_fd, (struct sockaddr *)&addr, sizeof addr))
+		RET_ERROR("Failed to bind %s: %s", path, strerror(errno));
+
+	if (listen(server.listen_fd, 64))
+		RET_ERROR("Failed to listen on %s: %s", path, strerror(errno));
+
+	if (fcntl(server.listen_fd, F_SETFL, O_NONBLOCK))
+		RET_ERROR("Failed to make socket non-blocking: %s", strerror(errno));
+
+	return 0;
+}
+
+static int watch(int fd, void *tag)
+{
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = tag};
+	if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+		RET_ERROR("Failed to add fd to epoll: %s", strerror(errno));
+	return 0;
+}
+
+static void usage(void)
+{
+	fputs(
+		"Usage: chip8-server [options]\n"
+		"  --socket PATH   Unix socket to listen on (default chip8.sock)\n"
+		"  --threads N     Worker threads, 0 for one per CPU (default 0)\n"
+		"  --hz N          Instructions per second per session (default "
+		"600)\n",
+		stderr);
+}
+
+// Parses a decimal number up to 'max'. Unlike plain strtoul, rejects signs,
+// leading whitespace and values that do not fit.
+static bool parse_count(const char *arg, ulong max, ulong *out)
+{
+	if (!isdigit((unsigned char)arg[0]))
+		return false;
+	char *end;
+	errno = 0;
+	const ulong v = strtoul(arg, &end, 10);
+	if (*end || errno || v > max)
+		return false;
+	*out = v;
+	return true;
+}
+
+int server_main(int argc, char *argv[])
+{
+	const char *path = "chip8.sock";
+	ulong threads = 0;
+	ulong hz = 600;
+
+	for (int a = 1; a < argc; a++) {
+		if (!strcmp(argv[a], "--help")) {
+			usage();
+			return 0;
+		}
+		if (a + 1 == argc) {
+			usage();
+			RET_ERROR("Unknown or incomplete option: %s", argv[a]);
+		}
+		if (!strcmp(argv[a], "--socket"))
+			path = argv[++a];
+		else if (!strcmp(argv[a], "--threads")) {
+			if (!parse_count(argv[++a], MAX_THREADS, &threads))
+				RET_ERROR(
+					"--threads expects a number up to %d.", MAX_THREADS);
+		} else if (!strcmp(argv[a], "--hz")) {
+			if (!parse_count(argv[++a], MAX_HZ, &hz) || hz < 60)
+				RET_ERROR("--hz expects a number from 60 to %d.", MAX_HZ);
+		} else {
+			usage();
+			RET_ERROR("Unknown option: %s", argv[a]);
+		}
+	}
+
+	server.hz = hz;
+
+	// Exit cleanly on SIGINT and SIGTERM so the socket gets removed.
+	// Blocked before the workers start so that they inherit the mask.
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL))
+		RET_ERROR("Failed to block signals: %s", strerror(errno));
+	server.signal_fd = signalfd(-1, &mask, 0);
+	if (server.signal_fd < 0)
+		RET_ERROR("Failed to create signalfd: %s", strerror(errno));
+
+	server.workers = workers_create(threads);
+	if (!server.workers)
+		RET_ERROR("Failed to start worker threads.");
+
+	server.epoll_fd = epoll_create1(0);
+	if (server.epoll_fd < 0)
+		RET_ERROR("Failed to create epoll instance: %s", strerror(errno));
+
+	int res = listen_on(path);
+	if (res)
+		return res;
+
+	// One tick per 60 Hz frame.
+	server.timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (server.timer_fd < 0)
+		RET_ERROR("Failed to create timer: %s", strerror(errno));
+	const struct itimerspec tick = {
+		.it_interval = {.tv_nsec = 1000000000L / 60},
+		.it_value = {.tv_nsec = 1000000000L / 60},
+	};
+	if (timerfd_settime(server.timer_fd, 0, &tick, NULL))
+		RET_ERROR("Failed to start timer: %s", strerror(errno));
+
+	if ((res = watch(server.listen_fd, &server.listen_fd)) ||
+		(res = watch(server.timer_fd, &server.timer_fd)) ||
+		(res = watch(server.signal_fd, &server.signal_fd)))
+		return res;
+
+	printf(
+		"Listening on %s with %u threads at %lu Hz.\n",
+		path,
+		workers_count(server.workers),
+		hz);
+	fflush(stdout);
+
+	bool running = true;
+	while (running) {
+		struct epoll_event events[64];
+		const int n =
+			epoll_wait(server.epoll_fd, events, ARRAY_LEN(events), -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			RET_ERROR("epoll_wait failed: %s", strerror(errno));
+		}
+
+		for (int e = 0; e < n; e++) {
+			void *tag = events[e].data.ptr;
+
+			if (tag == &server.signal_fd) {
+				running = false;
+			} else if (tag == &server.listen_fd) {
+				accept_clients();
+			} else if (tag == &server.timer_fd) {
+				u64 expirations;
+				if (read(server.timer_fd, &expirations, sizeof expirations) !=
+					sizeof expirations)
+					continue;
+				if (expirations > MAX_CATCHUP_FRAMES)
+					expirations = MAX_CATCHUP_FRAMES;
+				while (expirations--)
+					run_frame();
+				for (size_t i = 0; i < server.nactive; i++)
+					if (server.active[i]->owner->out_len)
+						flush(server.active[i]->owner);
+			} else {
+				struct client *c = tag;
+				if (c->dead)
+					continue;
+				if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+					receive(c);
+				else if (events[e].events & EPOLLOUT)
+					flush(c);
+			}
+		}
+
+		// Clients are freed here so that no event in the batch above can
+		// still refer to them.
+		while (server.dead) {
+			struct client *c = server.dead;
+			server.dead = c->next_dead;
+			close_client(c);
+		}
+	}
+
+	close(server.listen_fd);
+	unlink(path);
+	workers_destroy(server.workers);
+	return 0;
+}
@@ -0,0 +1,594 @@
+#include "../include/chip8_analyze.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/chip8.h"
+#include "defs.h"
+
+// Mirrors the switch in chip8_cycle (src/cycle.h).
+struct chip8_insn chip8_decode(u16 ins)
+{
+	struct chip8_insn d = {
+		.op = CHIP8_OP_INVALID,
+		.x = (ins & 0x0F00) >> 8,
+		.y = (ins & 0x00F0) >> 4,
+		.n = ins & 0x000F,
+		.nn = ins & 0x00FF,
+		.nnn = ins & 0x0FFF,
+	};
+
+	switch ((ins & 0xF000) >> 12) {
+	case 0x0:
+		if (ins == 0x00E0)
+			d.op = CHIP8_OP_CLS;
+		else if (ins == 0x00EE)
+			d.op = CHIP8_OP_RET;
+		// SYS is not supported.
+		break;
+	case 0x1:
+		d.op = CHIP8_OP_JP;
+		break;
+	case 0x2:
+		d.op = CHIP8_OP_CALL;
+		break;
+	case 0x3:
+		d.op = CHIP8_OP_SE_NN;
+		break;
+	case 0x4:
+		d.op = CHIP8_OP_SNE_NN;
+		break;
+	case 0x5:
+		if (d.n == 0)
+			d.op = CHIP8_OP_SE;
+		break;
+	case 0x6:
+		d.op = CHIP8_OP_LD_NN;
+		break;
+	case 0x7:
+		d.op = CHIP8_OP_ADD_NN;
+		break;
+	case 0x8:
+		switch (d.n) {
+		case 0x0:
+			d.op = CHIP8_OP_LD;
+			break;
+		case 0x1:
+			d.op = CHIP8_OP_OR;
+			break;
+		case 0x2:
+			d.op = CHIP8_OP_AND;
+			break;
+		case 0x3:
+			d.op = CHIP8_OP_XOR;
+			break;
+		case 0x4:
+			d.op = CHIP8_OP_ADD;
+			break;
+		case 0x5:
+			d.op = CHIP8_OP_SUB;
+			break;
+		case 0x6:
+			d.op = CHIP8_OP_SHR;
+			break;
+		case 0x7:
+			d.op = CHIP8_OP_SUBN;
+			break;
+		case 0xE:
+			d.op = CHIP8_OP_SHL;
+			break;
+		}
+		break;
+	case 0x9:
+		if (d.n == 0)
+			d.op = CHIP8_OP_SNE;
+		break;
+	case 0xA:
+		d.op = CHIP8_OP_LD_I;
+		break;
+	case 0xB:
+		d.op = CHIP8_OP_JP_V0;
+		break;
+	case 0xC:
+		d.op = CHIP8_OP_RND;
+		break;
+	case 0xD:
+		d.op = CHIP8_OP_DRW;
+		break;
+	case 0xE:
+		if (d.nn == 0x9E)
+			d.op = CHIP8_OP_SKP;
+		else if (d.nn == 0xA1)
+			d.op = CHIP8_OP_SKNP;
+		break;
+	case 0xF:
+		switch (d.nn) {
+		case 0x07:
+			d.op = CHIP8_OP_LD_VX_DT;
+			break;
+		case 0x0A:
+			d.op = CHIP8_OP_LD_VX_K;
+			break;
+		case 0x15:
+			d.op = CHIP8_OP_LD_DT_VX;
+			break;
+		case 0x18:
+			d.op = CHIP8_OP_LD_ST_VX;
+			break;
+		case 0x1E:
+			d.op = CHIP8_OP_ADD_I_VX;
+			break;
+		case 0x29:
+			d.op = CHIP8_OP_LD_F_VX;
+			break;
+		case 0x33:
+			d.op = CHIP8_OP_LD_B_VX;
+			break;
+		case 0x55:
+			d.op = CHIP8_OP_LD_MEM_VX;
+			break;
+		case 0x65:
+			d.op = CHIP8_OP_LD_VX_MEM;
+			break;
+		}
+		break;
+	}
+	return d;
+}
+
+int chip8_format_insn(char *buf, size_t len, struct chip8_insn d)
+{
+	const uint x = d.x, y = d.y, n = d.n, nn = d.nn, nnn = d.nnn;
+
+	switch (d.op) {
+	case CHIP8_OP_INVALID:
+		return snprintf(buf, len, "???");
+	case CHIP8_OP_CLS:
+		return snprintf(buf, len, "CLS");
+	case CHIP8_OP_RET:
+		return snprintf(buf, len, "RET");
+	case CHIP8_OP_JP:
+		return snprintf(buf, len, "JP %03X", nnn);
+	case CHIP8_OP_CALL:
+		return snprintf(buf, len, "CALL %03X", nnn);
+	case CHIP8_OP_SE_NN:
+		return snprintf(buf, len, "SE V%X, %02X", x, nn);
+	case CHIP8_OP_SNE_NN:
+		return snprintf(buf, len, "SNE V%X, %02X", x, nn);
+	case CHIP8_OP_SE:
+		return snprintf(buf, len, "SE V%X, V%X", x, y);
+	case CHIP8_OP_LD_NN:
+		return snprintf(buf, len, "LD V%X, %02X", x, nn);
+	case CHIP8_OP_ADD_NN:
+		return snprintf(buf, len, "ADD V%X, %02X", x, nn);
+	case CHIP8_OP_LD:
+		return snprintf(buf, len, "LD V%X, V%X", x, y);
+	case CHIP8_OP_OR:
+		return snprintf(buf, len, "OR V%X, V%X", x, y);
+	case CHIP8_OP_AND:
+		return snprintf(buf, len, "AND V%X, V%X", x, y);
+	case CHIP8_OP_XOR:
+		return snprintf(buf, len, "XOR V%X, V%X", x, y);
+	case CHIP8_OP_ADD:
+		return snprintf(buf, len, "ADD V%X, V%X", x, y);
+	case CHIP8_OP_SUB:
+		return snprintf(buf, len, "SUB V%X, V%X", x, y);
+	case CHIP8_OP_SHR:
+		return snprintf(buf, len, "SHR V%X", x);
+	case CHIP8_OP_SUBN:
+		return snprintf(buf, len, "SUBN V%X, V%X", x, y);
+	case CHIP8_OP_SHL:
+		return snprintf(buf, len, "SHL V%X", x);
+	case CHIP8_OP_SNE:
+		return snprintf(buf, len, "SNE V%X, V%X", x, y);
+	case CHIP8_OP_LD_I:
+		return snprintf(buf, len, "LD I, %03X", nnn);
+	case CHIP8_OP_JP_V0:
+		return snprintf(buf, len, "JP V0, %03X", nnn);
+	case CHIP8_OP_RND:
+		return snprintf(buf, len, "RND V%X, %02X", x, nn);
+	case CHIP8_OP_DRW:
+		return snprintf(buf, len, "DRW V%X, V%X, %X", x, y, n);
+	case CHIP8_OP_SKP:
+		return snprintf(buf, len, "SKP V%X", x);
+	case CHIP8_OP_SKNP:
+		return snprintf(buf, len, "SKNP V%X", x);
+	case CHIP8_OP_LD_VX_DT:
+		return snprintf(buf, len, "LD V%X, DT", x);
+	case CHIP8_OP_LD_VX_K:
+		return snprintf(buf, len, "LD V%X, K", x);
+	case CHIP8_OP_LD_DT_VX:
+		return snprintf(buf, len, "LD DT, V%X", x);
+	case CHIP8_OP_LD_ST_VX:
+		return snprintf(buf, len, "LD ST, V%X", x);
+	case CHIP8_OP_ADD_I_VX:
+		return snprintf(buf, len, "ADD I, V%X", x);
+	case CHIP8_OP_LD_F_VX:
+		return snprintf(buf, len, "LD F, V%X", x);
+	case CHIP8_OP_LD_B_VX:
+		return snprintf(buf, len, "LD B, V%X", x);
+	case CHIP8_OP_LD_MEM_VX:
+		return snprintf(buf, len, "LD [I], V%X", x);
+	case CHIP8_OP_LD_VX_MEM:
+		return snprintf(buf, len, "LD V%X, [I]", x);
+	}
+	return snprintf(buf, len, "???");
+}
+
+// What is known about I when an instruction runs.
+enum i_kind {
+	// The instruction has not been reached yet.
+	I_UNREACHED,
+	// I holds one of a few known values, such as sprites picked by a skip.
+	I_SET,
+	// I may hold more values than are kept track of.
+	I_ANY,
+};
+
+struct i_value {
+	enum i_kind kind;
+	// The number of values for I_SET.
+	u8 n;
+	// Sorted.
+	u16 v[CHIP8_ANALYZE_MAX_I];
+};
+
+static const struct i_value i_any = {.kind = I_ANY};
+
+static struct i_value i_const(u16 v)
+{
+	return (struct i_value){I_SET, 1, {v}};
+}
+
+// Everything the walk over the program keeps track of.
+struct walk {
+	const u8 *mem;
+	struct chip8_analysis *out;
+	// I on entry to each instruction.
+	struct i_value i[0x1000];
+	// Addresses waiting to be looked at (again).
+	u16 work[0x1000];
+	bool queued[0x1000];
+	uint nwork;
+	// The instruction at each address ends its block.
+	bool ends_block[0x1000];
+	// A block starts at each address.
+	bool leader[0x1000];
+};
+
+static u16 fetch(const u8 *mem, u16 pc) { return mem[pc] << 8 | mem[pc + 1]; }
+
+static struct i_value join(struct i_value a, struct i_value b)
+{
+	if (a.kind == I_UNREACHED)
+		return b;
+	if (b.kind == I_UNREACHED)
+		return a;
+	if (a.kind == I_ANY || b.kind == I_ANY)
+		return i_any;
+
+	// Merges the two sorted sets, giving up once there are too many values.
+	struct i_value m = {.kind = I_SET};
+	uint x = 0, y = 0;
+	while (x < a.n || y < b.n) {
+		u16 v;
+		if (y == b.n || (x < a.n && a.v[x] < b.v[y])) {
+			v = a.v[x++];
+		} else {
+			if (x < a.n && a.v[x] == b.v[y])
+				x++;
+			v = b.v[y++];
+		}
+		if (m.n == CHIP8_ANALYZE_MAX_I)
+			return i_any;
+		m.v[m.n++] = v;
+	}
+	return m;
+}
+
+static bool same(struct i_value a, struct i_value b)
+{
+	return a.kind == b.kind && a.n == b.n &&
+		!memcmp(a.v, b.v, a.n * sizeof a.v[0]);
+}
+
+// Merges what is known about I on one more path into address 'pc'.
+static void flow(struct walk *w, uint pc, struct i_value in)
+{
+	// chip8_cycle refuses to fetch from here, so the path ends.
+	if (pc >= 0xFFF)
+		return;
+
+	const struct i_value merged = join(w->i[pc], in);
+	if (same(merged, w->i[pc]))
+		return;
+	w->i[pc] = merged;
+	if (!w->queued[pc]) {
+		w->queued[pc] = true;
+		w->work[w->nwork++] = pc;
+	}
+}
+
+// Flows into 'pc' from somewhere other than the instruction before it.
+static void branch(struct walk *w, uint pc, struct i_value in, u8 flag)
+{
+	if (pc >= 0xFFF)
+		return;
+	w->leader[pc] = true;
+	w->out->flags[pc] |= flag;
+	flow(w, pc, in);
+}
+
+// Flags the 'len' bytes from each value I may hold.
+static void mark(struct walk *w, struct i_value i, uint len, u8 flag)
+{
+	for (uint k = 0; k < i.n; k++)
+		for (uint a = i.v[k]; a < i.v[k] + len && a < 0x1000; a++)
+			w->out->flags[a] |= flag;
+}
+
+// Follows the control flow out of the instruction at 'pc'.
+static void step(struct walk *w, u16 pc)
+{
+	u8 *flags = w->out->flags;
+	struct i_value i = w->i[pc];
+
+	flags[pc] |= CHIP8_BYTE_CODE;
+	flags[pc + 1] |= CHIP8_BYTE_CODE_TAIL;
+
+	const struct chip8_insn d = chip8_decode(fetch(w->mem, pc));
+	const uint next = pc + 2;
+
+	switch (d.op) {
+	case CHIP8_OP_INVALID:
+	case CHIP8_OP_RET:
+	case CHIP8_OP_JP_V0:
+		w->ends_block[pc] = true;
+		return;
+
+	case CHIP8_OP_JP:
+		w->ends_block[pc] = true;
+		branch(w, d.nnn, i, CHIP8_BYTE_JUMP_TARGET);
+		return;
+
+	case CHIP8_OP_CALL:
+		w->ends_block[pc] = true;
+		branch(w, d.nnn, i, CHIP8_BYTE_CALL_TARGET);
+		// The subroutine may leave anything in I.
+		branch(w, next, i_any, 0);
+		return;
+
+	case CHIP8_OP_SE_NN:
+	case CHIP8_OP_SNE_NN:
+	case CHIP8_OP_SE:
+	case CHIP8_OP_SNE:
+	case CHIP8_OP_SKP:
+	case CHIP8_OP_SKNP:
+		w->ends_block[pc] = true;
+		branch(w, next, i, CHIP8_BYTE_JUMP_TARGET);
+		branch(w, pc + 4, i, CHIP8_BYTE_JUMP_TARGET);
+		return;
+
+	case CHIP8_OP_LD_I:
+		flow(w, next, i_const(d.nnn));
+		return;
+
+	case CHIP8_OP_ADD_I_VX:
+	case CHIP8_OP_LD_F_VX:
+		flow(w, next, i_any);
+		return;
+
+	case CHIP8_OP_DRW:
+		mark(w, i, d.n, CHIP8_BYTE_SPRITE);
+		break;
+
+	case CHIP8_OP_LD_VX_MEM:
+		mark(w, i, d.x + 1, CHIP8_BYTE_READ);
+		break;
+
+	case CHIP8_OP_LD_B_VX:
+		mark(w, i, 3, CHIP8_BYTE_WRITTEN);
+		break;
+
+	case CHIP8_OP_LD_MEM_VX:
+		mark(w, i, d.x + 1, CHIP8_BYTE_WRITTEN);
+		break;
+
+	default:
+		break;
+	}
+	flow(w, next, i);
+}
+
+// Appends to a growable array. Returns false when out of memory.
+static bool push(void **arr, size_t *len, size_t size, const void *item)
+{
+	// Grow at powers of two.
+	if ((*len & (*len - 1)) == 0) {
+		void *a = realloc(*arr, (*len ? *len * 2 : 1) * size);
+		if (!a)
+			return false;
+		*arr = a;
+	}
+	memcpy((u8 *)*arr + *len * size, item, size);
+	++*len;
+	return true;
+}
+
+#define PUSH(arr, len, item) \
+	push((void **)&(arr), &(len), sizeof *(arr), &(item))
+
+static bool add_edge(
+	struct chip8_analysis *out,
+	u16 from,
+	u16 to,
+	enum chip8_edge_kind kind)
+{
+	const struct chip8_edge e = {from, to, kind};
+	return PUSH(out->edges, out->nedges, e);
+}
+
+// Splits the reached instructions into blocks and connects them.
+static bool build_cfg(struct walk *w)
+{
+	struct chip8_analysis *out = w->out;
+
+	for (uint pc = 0; pc < 0x1000; pc++) {
+		if (w->i[pc].kind == I_UNREACHED)
+			continue;
+		// Only addresses that are not the straight line continuation of a
+		// block start one.
+		const bool continues = pc >= 2 &&
+			w->i[pc - 2].kind != I_UNREACHED && !w->ends_block[pc - 2];
+		if (continues && !w->leader[pc])
+			continue;
+
+		struct chip8_block b = {.start = pc};
+		uint end = pc;
+		while (!w->ends_block[end] && end + 2 < 0x1000 &&
+			   w->i[end + 2].kind != I_UNREACHED && !w->leader[end + 2])
+			end += 2;
+		b.end = end + 2;
+
+		if (!w->ends_block[end]) {
+			// Falls into the next block, or off the end of memory.
+			if (b.end >= 0xFFF)
+				b.exits = true;
+			else if (!add_edge(out, pc, b.end, CHIP8_EDGE_NEXT))
+				return false;
+		} else if (end < 0xFFF) {
+			const struct chip8_insn d = chip8_decode(fetch(w->mem, end));
+			bool ok = true;
+			switch (d.op) {
+			case CHIP8_OP_JP:
+				ok = add_edge(out, pc, d.nnn, CHIP8_EDGE_JUMP);
+				break;
+			case CHIP8_OP_CALL:
+				ok = add_edge(out, pc, d.nnn, CHIP8_EDGE_CALL) &&
+					add_edge(out, pc, end + 2, CHIP8_EDGE_NEXT);
+				break;
+			case CHIP8_OP_INVALID:
+			case CHIP8_OP_RET:
+			case CHIP8_OP_JP_V0:
+				b.exits = true;
+				break;
+			default: // A skip
+				ok = add_edge(out, pc, end + 2, CHIP8_EDGE_NEXT) &&
+					add_edge(out, pc, end + 4, CHIP8_EDGE_SKIP);
+				break;
+			}
+			if (!ok)
+				return false;
+		} else {
+			b.exits = true;
+		}
+
+		if (!PUSH(out->blocks, out->nblocks, b))
+			return false;
+	}
+	return true;
+}
+
+// Lists stores, dynamic jumps and invalid instructions, and decides whether
+// the code is static.
+static bool report(struct walk *w)
+{
+	struct chip8_analysis *out = w->out;
+	const u8 *flags = out->flags;
+	bool static_code = true;
+
+	for (uint pc = 0; pc < 0xFFF; pc++) {
+		const struct i_value i = w->i[pc];
+		if (i.kind == I_UNREACHED)
+			continue;
+
+		const struct chip8_insn d = chip8_decode(fetch(w->mem, pc));
+		const u16 addr = pc;
+		switch (d.op) {
+		case CHIP8_OP_INVALID:
+			if (!PUSH(out->invalid, out->ninvalid, addr))
+				return false;
+			break;
+		case CHIP8_OP_JP_V0:
+			static_code = false;
+			if (!PUSH(out->dynamic_jumps, out->ndynamic_jumps, addr))
+				return false;
+			break;
+		case CHIP8_OP_LD_B_VX:
+		case CHIP8_OP_LD_MEM_VX: {
+			struct chip8_store s = {
+				.pc = pc,
+				.ni = i.n,
+				.len = d.op == CHIP8_OP_LD_B_VX ? 3 : d.x + 1,
+				.hits_code = i.kind != I_SET,
+			};
+			memcpy(s.i, i.v, sizeof s.i);
+			for (uint k = 0; k < s.ni; k++)
+				for (uint a = s.i[k]; a < s.i[k] + s.len && a < 0x1000; a++)
+					if (flags[a] & (CHIP8_BYTE_CODE | CHIP8_BYTE_CODE_TAIL))
+						s.hits_code = true;
+			static_code &= !s.hits_code;
+			if (!PUSH(out->stores, out->nstores, s))
+				return false;
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	out->static_code = static_code;
+	return true;
+}
+
+bool chip8_analyze(const u8 *rom, size_t sz, struct chip8_analysis *out)
+{
+	memset(out, 0, sizeof *out);
+
+	struct walk *w = calloc(1, sizeof *w);
+	struct chip8 *emu = malloc(sizeof *emu);
+	if (!w || !emu) {
+		free(w);
+		free(emu);
+		return false;
+	}
+
+	// Let chip8_init lay out the font and ROM.
+	chip8_init(emu, rom, sz);
+	memcpy(out->mem, emu->mem, sizeof out->mem);
+	free(emu);
+	w->mem = out->mem;
+	w->out = out;
+
+	// Nothing sets I before the program starts.
+	w->leader[0x200] = true;
+	flow(w, 0x200, i_const(0));
+	while (w->nwork) {
+		const u16 pc = w->work[--w->nwork];
+		w->queued[pc] = false;
+		step(w, pc);
+	}
+
+	const bool ok = build_cfg(w) && report(w);
+	free(w);
+	if (!ok)
+		chip8_analysis_free(out);
+	return ok;
+}
+
+void chip8_analysis_free(struct chip8_analysis *a)
+{
+	free(a->blocks);
+	free(a->edges);
+	free(a->stores);
+	free(a->dynamic_jumps);
+	free(a->invalid);
+	a->blocks = NULL;
+	a->edges = NULL;
+	a->stores = NULL;
+	a->dynamic_jumps = NULL;
+	a->invalid = NULL;
+	a->nblocks = a->nedges = a->nstores = 0;
+	a->ndynamic_jumps = a->ninvalid = 0;
+}
@@ -0,0 +1,170 @@
+#include "../include/chip8_env.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+#include "runner.h"
+#include "workers.h"
+
+struct chip8_env {
+	struct runner r;
+	struct chip8_env_config config;
+	u8 rom[CHIP8_MAX_ROM_SIZE];
+	u32 episode;
+	// Still in the episode chip8_env_create started, with no step taken.
+	// The first reset keeps its seed instead of moving on.
+	bool untouched;
+	u32 steps;
+	u32 score;
+	bool done;
+};
+
+struct chip8_env_threads {
+	struct workers *workers;
+};
+
+// Reads the score from memory. Out of range digits count as zero.
+static u32 read_score(const struct chip8_env *env)
+{
+	const struct chip8_env_config *c = &env->config;
+	const u8 *mem = env->r.emu.mem;
+	u32 score = 0;
+	for (uint b = 0; b < c->score_len; b++) {
+		const u8 byte = mem[c->score_addr + b];
+		if (c->score_format == CHIP8_SCORE_BCD)
+			score = score * 10 + (byte < 10 ? byte : 0);
+		else
+			score = score << 8 | byte;
+	}
+	return score;
+}
+
+static void start_episode(struct chip8_env *env)
+{
+	const struct chip8_env_config *c = &env->config;
+	runner_init(
+		&env->r, c->rom, c->rom_size, c->seed + env->episode * 0x9E3779B9UL);
+	env->steps = 0;
+	env->score = read_score(env);
+	env->done = false;
+}
+
+struct chip8_env *chip8_env_create(const struct chip8_env_config *config)
+{
+	if (config->rom_size > CHIP8_MAX_ROM_SIZE ||
+		config->cycles_per_frame == 0 || config->frames_per_step == 0 ||
+		config->score_len > 4 ||
+		config->score_addr + config->score_len > 0x1000)
+		return NULL;
+
+	struct chip8_env *env = malloc(sizeof *env);
+	if (!env)
+		return NULL;
+
+	env->config = *config;
+	memcpy(env->rom, config->rom, config->rom_size);
+	env->config.rom = env->rom;
+	env->episode = 0;
+	env->untouched = true;
+	start_episode(env);
+	return env;
+}
+
+void chip8_env_destroy(struct chip8_env *env) { free(env); }
+
+static void reset(struct chip8_env *env)
+{
+	if (env->untouched)
+		env->untouched = false;
+	else
+		env->episode++;
+	start_episode(env);
+}
+
+void chip8_env_reset(struct chip8_env *const *envs, size_t n)
+{
+	for (size_t e = 0; e < n; e++)
+		reset(envs[e]);
+}
+
+struct step {
+	struct chip8_env *const *envs;
+	const u16 *actions;
+	u8 *obs;
+	float *rewards;
+	bool *dones;
+};
+
+static void step_one(void *ctx, size_t e)
+{
+	const struct step *s = ctx;
+	struct chip8_env *env = s->envs[e];
+	struct runner *r = &env->r;
+	const u16 keys = s->actions[e];
+
+	if (env->done)
+		reset(env);
+	env->untouched = false;
+
+	r->emu.keys = keys;
+	for (uint f = 0; f < env->config.frames_per_step && !env->done; f++) {
+		// Holding any key answers LD VX, K.
+		if (r->need_key && keys) {
+			u8 k = 0;
+			while (!(keys & 1 << k))
+				k++;
+			runner_supply_key(r, k);
+		}
+		if (runner_frame(r, env->config.cycles_per_frame) != CHIP8_OK)
+			env->done = true;
+	}
+
+	const u32 score = read_score(env);
+	s->rewards[e] = (float)((i64)score - env->score);
+	env->score = score;
+
+	env->steps++;
+	if (env->config.max_steps && env->steps >= env->config.max_steps)
+		env->done = true;
+	s->dones[e] = env->done;
+
+	chip8_pack_fb(&r->emu, s->obs + e * CHIP8_PACKED_FB_SIZE);
+}
+
+void chip8_env_step(
+	struct chip8_env *const *envs,
+	const u16 *actions,
+	size_t n,
+	u8 *obs,
+	float *rewards,
+	bool *dones,
+	struct chip8_env_threads *threads)
+{
+	struct step s = {envs, actions, obs, rewards, dones};
+	if (threads) {
+		workers_run(threads->workers, step_one, &s, n);
+		return;
+	}
+	for (size_t e = 0; e < n; e++)
+		step_one(&s, e);
+}
+
+struct chip8_env_threads *chip8_env_threads_create(unsigned n)
+{
+	struct chip8_env_threads *t = malloc(sizeof *t);
+	if (!t)
+		return NULL;
+	t->workers = workers_create(n);
+	if (!t->workers) {
+		free(t);
+		return NULL;
+	}
+	return t;
+}
+
+void chip8_env_threads_destroy(struct chip8_env_threads *t)
+{
+	workers_destroy(t->workers);
+	free(t);
+}
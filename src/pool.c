@@ -0,0 +1,112 @@
+#include "../include/chip8_pool.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defs.h"
+
+struct chip8_pool {
+	// Only counts pages, so relaxed ordering is enough.
+	atomic_size_t private_pages;
+	// Aligned to a page so that each page sits in as few cache lines as
+	// possible.
+	u8 *image;
+};
+
+struct chip8_pool *chip8_pool_create(const u8 *rom, size_t sz)
+{
+	struct chip8_pool *pool = malloc(sizeof *pool);
+	struct chip8 *tmp = malloc(sizeof *tmp);
+	u8 *image = aligned_alloc(CHIP8_PAGE_SIZE, sizeof tmp->mem);
+	if (!pool || !tmp || !image) {
+		free(pool);
+		free(tmp);
+		free(image);
+		return NULL;
+	}
+
+	// Let chip8_init lay out the font and ROM.
+	chip8_init(tmp, rom, sz);
+	memcpy(image, tmp->mem, sizeof tmp->mem);
+	free(tmp);
+
+	atomic_init(&pool->private_pages, 0);
+	pool->image = image;
+	return pool;
+}
+
+void chip8_pool_destroy(struct chip8_pool *pool)
+{
+	assert(atomic_load(&pool->private_pages) == 0);
+	free(pool->image);
+	free(pool);
+}
+
+size_t chip8_pool_private_pages(const struct chip8_pool *pool)
+{
+	return atomic_load_explicit(
+		&((struct chip8_pool *)pool)->private_pages, memory_order_relaxed);
+}
+
+void chip8_inst_init(struct chip8_inst *emu, struct chip8_pool *pool)
+{
+	memset(emu->v, 0, sizeof emu->v);
+	emu->i = 0;
+	emu->pc = 0x200;
+	memset(emu->sas, 0, sizeof emu->sas);
+	emu->sp = 0;
+	emu->keys = 0;
+	emu->dtimer_buf = 0;
+	emu->stimer_buf = 0;
+
+	emu->private_pages = 0;
+	emu->pool = pool;
+	for (int p = 0; p < CHIP8_PAGE_COUNT; p++)
+		emu->page[p] = pool->image + p * CHIP8_PAGE_SIZE;
+
+	memset(emu->fb, 0, sizeof emu->fb);
+}
+
+void chip8_inst_release(struct chip8_inst *emu)
+{
+	for (int p = 0; p < CHIP8_PAGE_COUNT; p++) {
+		if (!(emu->private_pages & 1 << p))
+			continue;
+		free((u8 *)emu->page[p]);
+		emu->page[p] = emu->pool->image + p * CHIP8_PAGE_SIZE;
+		atomic_fetch_sub_explicit(
+			&emu->pool->private_pages, 1, memory_order_relaxed);
+	}
+	emu->private_pages = 0;
+}
+
+u8 chip8_inst_peek(const struct chip8_inst *emu, u16 addr)
+{
+	return emu->page[addr / CHIP8_PAGE_SIZE][addr % CHIP8_PAGE_SIZE];
+}
+
+// Stores a byte, giving the instance its own copy of the page first.
+static bool poke(struct chip8_inst *emu, u16 addr, u8 b)
+{
+	const uint p = addr / CHIP8_PAGE_SIZE;
+	if (!(emu->private_pages & 1 << p)) {
+		u8 *copy = aligned_alloc(CHIP8_PAGE_SIZE, CHIP8_PAGE_SIZE);
+		if (!copy)
+			return false;
+		memcpy(copy, emu->page[p], CHIP8_PAGE_SIZE);
+		emu->page[p] = copy;
+		emu->private_pages |= 1 << p;
+		atomic_fetch_add_explicit(
+			&emu->pool->private_pages, 1, memory_order_relaxed);
+	}
+	((u8 *)emu->page[p])[addr % CHIP8_PAGE_SIZE] = b;
+	return true;
+}
+
+#define CHIP8_T struct chip8_inst
+#define FN(name) chip8_inst_##name
+#define MEM_READ(a) chip8_inst_peek(emu, a)
+#define MEM_WRITE(a, b) poke(emu, a, b)
+
+#include "cycle.h"
@@ -0,0 +1,66 @@
+#include "runner.h"
+
+static u8 mulberry32(u32 *state)
+{
+	u32 z = (*state += 0x6D2B79F5UL);
+	z = (z ^ (z >> 15)) * (z | 1UL);
+	z ^= z + (z ^ (z >> 7)) * (z | 61UL);
+	z = z ^ (z >> 14);
+	// Use top 8 bits of z
+	return z >> 24;
+}
+
+void runner_init(struct runner *r, const u8 *rom, size_t sz, u32 seed)
+{
+	chip8_init(&r->emu, rom, sz);
+	r->rng = seed;
+	r->dtimer = 0;
+	r->stimer = 0;
+	r->need_key = false;
+	r->dirty = true;
+}
+
+enum chip8_interrupt runner_frame(struct runner *r, uint cycles)
+{
+	for (uint c = 0; c < cycles && !r->need_key; c++) {
+		const enum chip8_interrupt in = chip8_cycle(&r->emu);
+		switch (in) {
+		case CHIP8_OK:
+			break;
+		case CHIP8_NEED_RAND:
+			chip8_supply_rand(&r->emu, mulberry32(&r->rng));
+			break;
+		case CHIP8_NEED_KEY:
+			r->need_key = true;
+			break;
+		case CHIP8_GFX_CLEAR:
+		case CHIP8_GFX_DRAW:
+			r->dirty = true;
+			break;
+		case CHIP8_DELAY_TIMER_WRITE:
+			r->dtimer = r->emu.dtimer_buf;
+			break;
+		case CHIP8_NEED_DELAY_TIMER:
+			chip8_supply_delay_timer(&r->emu, r->dtimer);
+			break;
+		case CHIP8_SOUND_TIMER_WRITE:
+			r->stimer = r->emu.stimer_buf;
+			break;
+		default:
+			return in;
+		}
+	}
+
+	if (r->dtimer)
+		r->dtimer--;
+	if (r->stimer)
+		r->stimer--;
+	return CHIP8_OK;
+}
+
+void runner_supply_key(struct runner *r, u8 k)
+{
+	assert(r->need_key);
+	chip8_supply_key(&r->emu, k);
+	r->need_key = false;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "../include/chip8.h"
+#include "defs.h"
+
+// Drives a chip8 one 60 Hz frame at a time without looking at a wall clock.
+// Random numbers come from a seeded mulberry32 generator and the delay and
+// sound timers count down once per emulated frame, so a run is reproducible
+// from its seed and its inputs alone.
+//
+// A runner holds no pointers, so copying one by assignment takes a snapshot
+// that can later be copied back to rewind.
+struct runner {
+	struct chip8 emu;
+	// mulberry32 PRNG state.
+	u32 rng;
+	// The current values of the delay and sound timers.
+	u8 dtimer;
+	u8 stimer;
+	// The emulator is blocked on LD VX, K until runner_supply_key is called.
+	bool need_key;
+	// Set when the frame buffer was drawn to or cleared.
+	// Never cleared by the runner itself.
+	bool dirty;
+};
+
+void runner_init(struct runner *, const u8 *rom, size_t sz, u32 seed);
+
+// Executes up to 'cycles' instructions and then ticks the timers.
+// Stops early while the emulator is waiting for a key.
+// Returns CHIP8_OK, or the interrupt that stopped the emulator for good.
+enum chip8_interrupt runner_frame(struct runner *, uint cycles);
+
+// Answers a pending LD VX, K. 'k' is in the range [0, 15].
+void runner_supply_key(struct runner *, u8 k);
@@ -0,0 +1,143 @@
+#include "workers.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct workers {
+	pthread_mutex_t lock;
+	// Signalled when a new job is posted or on shutdown.
+	pthread_cond_t start;
+	// Signalled when the last thread finishes its share of a job.
+	pthread_cond_t done;
+
+	// The current job.
+	void (*fn)(void *ctx, size_t i);
+	void *ctx;
+	size_t count;
+	// The next loop index to hand out.
+	atomic_size_t next;
+
+	// Incremented every time a job is posted.
+	ulong generation;
+	// The number of threads still working on the current job.
+	uint busy;
+	bool shutdown;
+
+	uint nthreads;
+	pthread_t threads[];
+};
+
+// Hands out loop indices until there are none left.
+static void work(struct workers *w)
+{
+	size_t i;
+	while ((i = atomic_fetch_add(&w->next, 1)) < w->count)
+		w->fn(w->ctx, i);
+}
+
+static void *worker_main(void *arg)
+{
+	struct workers *w = arg;
+	ulong seen = 0;
+
+	pthread_mutex_lock(&w->lock);
+	while (1) {
+		while (!w->shutdown && w->generation == seen)
+			pthread_cond_wait(&w->start, &w->lock);
+		if (w->shutdown)
+			break;
+		seen = w->generation;
+		pthread_mutex_unlock(&w->lock);
+
+		work(w);
+
+		pthread_mutex_lock(&w->lock);
+		if (--w->busy == 0)
+			pthread_cond_signal(&w->done);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+struct workers *workers_create(uint n)
+{
+	if (n == 0) {
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n = cpus > 0 ? cpus : 1;
+	}
+
+	// The calling thread does its share of the work too.
+	const uint nthreads = n - 1;
+
+	struct workers *w = malloc(sizeof *w + nthreads * sizeof w->threads[0]);
+	if (!w)
+		return NULL;
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->start, NULL);
+	pthread_cond_init(&w->done, NULL);
+	w->fn = NULL;
+	w->ctx = NULL;
+	w->count = 0;
+	atomic_init(&w->next, 0);
+	w->generation = 0;
+	w->busy = 0;
+	w->shutdown = false;
+	w->nthreads = 0;
+
+	for (uint t = 0; t < nthreads; t++) {
+		if (pthread_create(&w->threads[t], NULL, worker_main, w)) {
+			workers_destroy(w);
+			return NULL;
+		}
+		w->nthreads++;
+	}
+	return w;
+}
+
+void workers_run(
+	struct workers *w,
+	void (*fn)(void *ctx, size_t i),
+	void *ctx,
+	size_t count)
+{
+	if (count == 0)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->fn = fn;
+	w->ctx = ctx;
+	w->count = count;
+	atomic_store(&w->next, 0);
+	w->busy = w->nthreads;
+	w->generation++;
+	pthread_cond_broadcast(&w->start);
+	pthread_mutex_unlock(&w->lock);
+
+	work(w);
+
+	pthread_mutex_lock(&w->lock);
+	while (w->busy)
+		pthread_cond_wait(&w->done, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+}
+
+uint workers_count(const struct workers *w) { return w->nthreads + 1; }
+
+void workers_destroy(struct workers *w)
+{
+	pthread_mutex_lock(&w->lock);
+	w->shutdown = true;
+	pthread_cond_broadcast(&w->start);
+	pthread_mutex_unlock(&w->lock);
+
+	for (uint t = 0; t < w->nthreads; t++)
+		pthread_join(w->threads[t], NULL);
+
+	pthread_cond_destroy(&w->done);
+	pthread_cond_destroy(&w->start);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+}
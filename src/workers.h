@@ -0,0 +1,24 @@
+#pragma once
+
+#include "defs.h"
+
+// A fixed set of threads that run parallel for loops.
+struct workers;
+
+// Starts 'n' threads. Returns NULL on failure.
+// When 'n' is zero, one thread per online CPU is started.
+struct workers *workers_create(uint n);
+
+// Calls fn(ctx, i) for every i in [0, count) spread across the threads and
+// the calling thread. Returns when every call has returned.
+// Only one thread may call this at a time.
+void workers_run(
+	struct workers *,
+	void (*fn)(void *ctx, size_t i),
+	void *ctx,
+	size_t count);
+
+// Returns the number of threads including the calling thread.
+uint workers_count(const struct workers *);
+
+void workers_destroy(struct workers *);
@@ -0,0 +1,130 @@
+// Checks that chip8_decode agrees with chip8_cycle on every opcode: the
+// analyzer must reject exactly what the interpreter rejects, and every PC the
+// interpreter moves to must be a successor the analyzer would add to the
+// control flow graph. Skips must be seen both skipping and not skipping.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/defs.h"
+#include "chip8.h"
+#include "chip8_analyze.h"
+
+// Register and key setups that between them take each skip both ways:
+// all zero, every register equal to NN, registers that differ from each other,
+// and every key held.
+enum { SETUPS = 4 };
+
+static void setup(struct chip8 *emu, uint s, u16 ins)
+{
+	memset(emu, 0, sizeof *emu);
+	emu->pc = 0x200;
+	emu->i = 0x300;
+	emu->mem[0x200] = ins >> 8;
+	emu->mem[0x201] = ins;
+	for (uint r = 0; r < 16; r++)
+		emu->v[r] = s == 1 ? ins & 0xFF : s == 2 ? r + 1 : 0;
+	emu->keys = s == 3 ? 0xFFFF : 0;
+}
+
+// Runs the instruction, answering any request for input. Returns false when
+// the emulator stopped on it for good, which ends the path without a
+// successor.
+static bool run(struct chip8 *emu)
+{
+	switch (chip8_cycle(emu)) {
+	case CHIP8_OK:
+	case CHIP8_GFX_CLEAR:
+	case CHIP8_GFX_DRAW:
+	case CHIP8_DELAY_TIMER_WRITE:
+	case CHIP8_SOUND_TIMER_WRITE:
+		return true;
+	case CHIP8_NEED_RAND:
+		chip8_supply_rand(emu, 0);
+		return true;
+	case CHIP8_NEED_KEY:
+		chip8_supply_key(emu, 0);
+		return true;
+	case CHIP8_NEED_DELAY_TIMER:
+		chip8_supply_delay_timer(emu, 0);
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool is_skip(enum chip8_op op)
+{
+	switch (op) {
+	case CHIP8_OP_SE_NN:
+	case CHIP8_OP_SNE_NN:
+	case CHIP8_OP_SE:
+	case CHIP8_OP_SNE:
+	case CHIP8_OP_SKP:
+	case CHIP8_OP_SKNP:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Returns what is wrong with the decoding of 'ins', or NULL.
+static const char *check(u16 ins, struct chip8_insn d)
+{
+	static struct chip8 emu;
+
+	setup(&emu, 0, ins);
+	const bool invalid = chip8_cycle(&emu) == CHIP8_BAD_INSTRUCTION;
+	if (invalid != (d.op == CHIP8_OP_INVALID))
+		return "chip8_cycle disagrees on whether it is valid";
+	// Where these go is not known statically.
+	if (invalid || d.op == CHIP8_OP_RET || d.op == CHIP8_OP_JP_V0)
+		return NULL;
+
+	bool ran = false, fell_through = false, skipped = false;
+	for (uint s = 0; s < SETUPS; s++) {
+		setup(&emu, s, ins);
+		if (!run(&emu))
+			continue;
+		ran = true;
+
+		if (d.op == CHIP8_OP_JP || d.op == CHIP8_OP_CALL) {
+			if (emu.pc != d.nnn)
+				return "jumped somewhere other than NNN";
+		} else if (emu.pc == 0x202) {
+			fell_through = true;
+		} else if (emu.pc == 0x204 && is_skip(d.op)) {
+			skipped = true;
+		} else {
+			return "moved to a PC that is no successor";
+		}
+	}
+
+	if (!ran)
+		return "chip8_cycle never ran it";
+	// SE VX, VX always skips and SNE VX, VX never does.
+	const bool same_reg = (d.op == CHIP8_OP_SE || d.op == CHIP8_OP_SNE) &&
+		d.x == d.y;
+	if (is_skip(d.op) && !same_reg && !(skipped && fell_through))
+		return "a skip that did not go both ways";
+	return NULL;
+}
+
+int main(void)
+{
+	uint bad = 0;
+
+	for (uint ins = 0; ins <= 0xFFFF; ins++) {
+		const struct chip8_insn d = chip8_decode(ins);
+		const char *err = check(ins, d);
+		if (err && bad++ < 16) {
+			char text[32];
+			chip8_format_insn(text, sizeof text, d);
+			fprintf(stderr, "%04X: decoded as '%s': %s\n", ins, text, err);
+		}
+	}
+
+	if (bad)
+		fprintf(stderr, "%u opcodes decoded differently\n", bad);
+	return bad != 0;
+}
@@ -0,0 +1,177 @@
+// Runs each ROM given on the command line through chip8_cycle and
+// chip8_inst_cycle in lockstep with the same keys, random numbers and timer,
+// and checks that the two agree on every register, pixel and byte of memory.
+// Also checks that an instance that never ran still sees the pool's image and
+// that releasing an instance gives back all of its private pages.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/defs.h"
+#include "chip8.h"
+#include "chip8_pool.h"
+
+#define FRAMES 600
+#define CYCLES_PER_FRAME 20
+
+// xorshift32, so both emulators get the same inputs.
+static u32 next_rand(u32 *state)
+{
+	u32 x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static bool same_regs(const struct chip8 *a, const struct chip8_inst *b)
+{
+	return a->gfx_wrapping == b->gfx_wrapping &&
+		!memcmp(a->v, b->v, sizeof a->v) && a->i == b->i && a->pc == b->pc &&
+		!memcmp(a->sas, b->sas, sizeof a->sas) && a->sp == b->sp &&
+		a->keys == b->keys && a->dtimer_buf == b->dtimer_buf &&
+		a->stimer_buf == b->stimer_buf &&
+		!memcmp(a->fb, b->fb, sizeof a->fb);
+}
+
+static bool same_mem(const u8 *mem, const struct chip8_inst *b)
+{
+	for (uint addr = 0; addr < 0x1000; addr++)
+		if (mem[addr] != chip8_inst_peek(b, addr))
+			return false;
+	return true;
+}
+
+// Returns the number of failed checks.
+static uint run(const char *path)
+{
+	static u8 rom[CHIP8_MAX_ROM_SIZE];
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "%s: cannot open\n", path);
+		return 1;
+	}
+	const size_t sz = fread(rom, 1, sizeof rom, f);
+	fclose(f);
+
+	struct chip8_pool *pool = chip8_pool_create(rom, sz);
+	if (!pool) {
+		fprintf(stderr, "%s: out of memory\n", path);
+		return 1;
+	}
+
+	static struct chip8 a;
+	static struct chip8_inst b, idle;
+	chip8_init(&a, rom, sz);
+	chip8_inst_init(&b, pool);
+	chip8_inst_init(&idle, pool);
+
+	static u8 image[0x1000];
+	memcpy(image, a.mem, sizeof image);
+
+	u32 rng = 0x2545F491;
+	u8 dtimer = 0;
+	uint bad = 0;
+	bool running = true;
+	for (uint frame = 0; frame < FRAMES && running && !bad; frame++) {
+		// Mostly no key, sometimes one.
+		const u32 r = next_rand(&rng) % 32;
+		a.keys = b.keys = r < 16 ? 1 << r : 0;
+
+		for (uint c = 0; c < CYCLES_PER_FRAME && running; c++) {
+			const u16 pc = a.pc;
+			const enum chip8_interrupt in = chip8_cycle(&a);
+			enum chip8_interrupt inst_in = chip8_inst_cycle(&b);
+			// The instruction is retried once a page copy can be made.
+			if (inst_in == CHIP8_OUT_OF_MEMORY)
+				inst_in = chip8_inst_cycle(&b);
+
+			if (in != inst_in) {
+				fprintf(
+					stderr,
+					"%s: %03X: chip8_cycle returned %d, chip8_inst_cycle "
+					"%d\n",
+					path,
+					pc,
+					in,
+					inst_in);
+				bad++;
+				break;
+			}
+
+			switch (in) {
+			case CHIP8_OK:
+			case CHIP8_GFX_CLEAR:
+			case CHIP8_GFX_DRAW:
+			case CHIP8_SOUND_TIMER_WRITE:
+				break;
+			case CHIP8_NEED_RAND: {
+				const u8 v = next_rand(&rng);
+				chip8_supply_rand(&a, v);
+				chip8_inst_supply_rand(&b, v);
+				break;
+			}
+			case CHIP8_NEED_KEY: {
+				const u8 k = next_rand(&rng) % 16;
+				chip8_supply_key(&a, k);
+				chip8_inst_supply_key(&b, k);
+				break;
+			}
+			case CHIP8_DELAY_TIMER_WRITE:
+				dtimer = a.dtimer_buf;
+				break;
+			case CHIP8_NEED_DELAY_TIMER:
+				chip8_supply_delay_timer(&a, dtimer);
+				chip8_inst_supply_delay_timer(&b, dtimer);
+				break;
+			default:
+				// Both crashed the same way.
+				running = false;
+				break;
+			}
+
+			if (!same_regs(&a, &b)) {
+				fprintf(stderr, "%s: %03X: registers differ\n", path, pc);
+				bad++;
+				break;
+			}
+		}
+		if (dtimer)
+			dtimer--;
+
+		if (!bad && !same_mem(a.mem, &b)) {
+			fprintf(stderr, "%s: memory differs in frame %u\n", path, frame);
+			bad++;
+		}
+	}
+
+	if (!same_mem(image, &idle)) {
+		fprintf(stderr, "%s: an idle instance saw another's writes\n", path);
+		bad++;
+	}
+
+	uint copied = 0;
+	for (uint p = 0; p < CHIP8_PAGE_COUNT; p++)
+		copied += b.private_pages >> p & 1;
+	if (idle.private_pages || chip8_pool_private_pages(pool) != copied) {
+		fprintf(stderr, "%s: private pages miscounted\n", path);
+		bad++;
+	}
+
+	chip8_inst_release(&b);
+	chip8_inst_release(&idle);
+	if (chip8_pool_private_pages(pool) != 0) {
+		fprintf(stderr, "%s: private pages left after release\n", path);
+		bad++;
+	}
+	chip8_pool_destroy(pool);
+	return bad;
+}
+
+int main(int argc, char *argv[])
+{
+	uint bad = 0;
+	for (int a = 1; a < argc; a++)
+		bad += run(argv[a]);
+	return bad != 0;
+}